@@ -23,9 +23,127 @@
 #define _LibC_H_
 
 #include <stdlib.h>
+#include <stdio.h>
+#include "local_malloc.h"
+#include "local_printf.h"
 
+extern "C" {
 void *crealloc(void *ptr);
+void *malloc_ex(size_t size, int flags);
+int free_deferred(void *ptr);
+void *rc_alloc(size_t size);
+void *rc_retain(void *ptr);
+int rc_release(void *ptr);
+#ifdef MALLOC_HOOKS
+void malloc_sethooks(malloc_hook_fn pre, malloc_hook_fn post);
+uint32_t malloc_cycles(void);
+#endif
+#ifdef MALLOC_GUARD
+void malloc_guard_rate(uint16_t n);
+#endif
+int printf_register(char c, printf_conv_fn fn);
+#if LIBC_PRINTF_CACHE > 0
+int printf_precompile(const char * format);
+void printf_cache_stats(uint32_t * hits, uint32_t * misses);
+#endif
+int asprintf(char ** strp, const char * format, ...);
+int vasprintf(char ** strp, const char * format, va_list ap);
+// output helpers for user conversions
+int _putn(pint_t * pint, const char * s, int n);
+int _prints(pint_t * pint, char * s);
+int _printi(pint_t * pint, unsigned int num, char fmt);
+int _printll(pint_t * pint, uint64_t num, char fmt);
+}
+
 void printf_setprint(Print * p);
+int printf_addsink(Print * p, uint8_t mask);
+void printf_removesink(Print * p);
+uint8_t printf_setmask(uint8_t mask);
 int pprintf(Print& p, const char *format, ...);
+int mprintf(uint8_t mask, const char *format, ...);
+int phexdump(Print& p, const void * buf, size_t len, uint8_t flags = HEXDUMP_OFFSET | HEXDUMP_ASCII);
+int plog(Print& p, const char *format, ...);
+int pscanf(Stream& s, const char *format, ...);
+void printf_setfile(FILE * f, Print * p);
+FILE * pfopen(Print& p);
+void pfclose(FILE * f);
+int printf_service(void);
+
+/* what PrintQueue does with new output when it is full */
+#define PRINTF_QUEUE_DROP 0 // discard the new output
+#define PRINTF_QUEUE_BLOCK 1 // drain to the port inline (main context only - drops from interrupts on Cortex-M)
+#define PRINTF_QUEUE_OVERWRITE 2 // discard the oldest queued output
+
+namespace LibC {
+
+/* Print which appends everything written to it to a heap string - appendf formats straight into it in one
+   pass, growing the block with realloc (in place when it is the last one on the heap) */
+class StrBuf : public Print {
+public:
+    StrBuf(size_t reserve = 0);
+    ~StrBuf();
+    StrBuf(const StrBuf&) = delete;
+    StrBuf& operator=(const StrBuf&) = delete;
+    using Print::write;
+    virtual size_t write(uint8_t c);
+    virtual size_t write(const uint8_t * buf, size_t n);
+    int appendf(const char * format, ...); // characters appended, -1 if out of memory
+    int vappendf(const char * format, va_list ap);
+    const char * c_str(void) const { return sbuf ? sbuf : ""; }
+    size_t length(void) const { return slen; }
+    bool failed(void) const { return oom; } // an append ran out of memory (the string is truncated)
+    void clear(void);
+    const char * compact(void); // drop the spare space and crealloc the string down the heap
+    char * release(void); // compact and hand the string over (free it) - NULL if none allocated or failed
+private:
+    bool grow(size_t n);
+    char * sbuf;
+    size_t slen;
+    size_t scap;
+    bool oom;
+};
+
+/* Print which queues everything written to it in a ring buffer, for printf_service() to drain
+   to out later - buf is caller supplied, size is rounded down to a power of two (max 32k, min 8 - smaller
+   buffers drop everything) */
+class PrintQueue : public Print {
+public:
+    PrintQueue(Print& out, void * buf, uint16_t size, uint8_t policy = PRINTF_QUEUE_DROP);
+    ~PrintQueue(); // off the printf_service list
+    PrintQueue(const PrintQueue&) = delete;
+    PrintQueue& operator=(const PrintQueue&) = delete;
+    using Print::write;
+    virtual size_t write(uint8_t c);
+    virtual size_t write(const uint8_t * buf, size_t n);
+    int service(int max = -1); // -1 as much as out.availableForWrite(), 0 everything, else at most max bytes
+    uint16_t queued(void);
+    uint32_t dropped; // bytes of new output discarded
+    uint32_t overwritten; // bytes of queued output discarded for newer output
+private:
+    bool push(const uint8_t * s, uint16_t n);
+    bool pop(void);
+    Print& out;
+    uint8_t * qbuf;
+    uint16_t qsize;
+    uint8_t policy;
+    volatile uint8_t busy; // Q_BUSY_* - consumer is draining / releasing a record
+    volatile uint16_t head; // free running byte positions
+    volatile uint16_t tail;
+    uint16_t rofs; // bytes of the oldest record already sent
+    PrintQueue * next;
+    friend int ::printf_service(void);
+};
+
+}
+
+#ifdef MALLOC_GUARD
+void malloc_guard_setprint(Print * p);
+#endif
+
+#ifdef MALLOC_HOOKS
+void malloc_hist_start(void);
+void malloc_hist_stop(void);
+void malloc_hist_report(Print& p);
+#endif
 
 #endif
@@ -0,0 +1,309 @@
+/*
+ * Copyright 2018 Justin Schoeman
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+ * software and associated documentation files (the "Software"), to deal in the Software 
+ * without restriction, including without limitation the rights to use, copy, modify, 
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+ * permit persons to whom the Software is furnished to do so, subject to the following 
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _LIBC_FORMAT_H_
+#define _LIBC_FORMAT_H_
+
+/*
+    Compile time parsed printf for C++17 callers
+
+    LibC::printf(Serial, LIBC_FMT("x=%d y=%5.2f\n"), x, y);
+    LibC::snprintf(buf, sizeof(buf), LIBC_FMT("%s:%u"), name, port);
+
+    The format is parsed at compile time with the same rules as _vprintf, into a table of literal runs
+    and conversions. Argument types and count are checked with static_assert, and each conversion calls
+    the printf.c renderers directly - no runtime parsing, no va_arg, and renderers which are never used
+    (eg floats) are not referenced. 64 bit arguments are rendered with _printll whatever the modifier,
+    and %'g of a float argument gives the shortest float digits. As for the C version, 'a' is rendered
+    as 'e'.
+*/
+
+#if __cplusplus < 201703L
+#error LibC_format.h needs C++17
+#endif
+
+#include <errno.h>
+#include <tuple>
+#include <type_traits>
+#include "local_printf.h"
+
+extern "C" {
+int _putn(pint_t * pint, const char * s, int n);
+void _pend(pint_t * pint);
+int _prints(pint_t * pint, char * s);
+int _printi(pint_t * pint, unsigned int num, char fmt);
+int _printll(pint_t * pint, uint64_t num, char fmt);
+int _printf(pint_t * pint, double fnum, char fmt);
+int _printk(pint_t * pint, uint64_t num, int bits, char fmt);
+int _printh(pint_t * pint, const uint8_t * buf, int len);
+}
+
+// wrap a string literal in a type, so it can be parsed at compile time
+#define LIBC_FMT(s) ([] { struct _libc_fmt { static constexpr const char * str() { return s; } }; return _libc_fmt(); }())
+
+namespace LibC {
+
+// a run of literal text, followed by one conversion
+struct fmt_spec {
+    uint16_t lit; // offset of the literal run
+    uint16_t litn; // length of the literal run
+    char conv; // as passed to the renderers (lower case, d is i, a is e) - 0 for none (end of format)
+    char raw; // conversion character as written - output as is if conv is not recognised
+    char mod;
+    uint8_t flags;
+    uint8_t width;
+    uint8_t prec;
+    uint8_t star; // 1 = width from argument, 2 = precision from argument
+};
+
+template<size_t N> struct fmt_specs {
+    fmt_spec s[N];
+};
+
+constexpr bool fmt_isdigit(char c) { return c >= '0' && c <= '9'; }
+
+// arguments consumed by a conversion
+constexpr size_t fmt_argc(const fmt_spec & sp) {
+    size_t n = (sp.star & 1 ? 1 : 0) + (sp.star & 2 ? 1 : 0);
+    switch(sp.conv) {
+        case 's': case 'c': case 'i': case 'o': case 'u': case 'x':
+        case 'e': case 'f': case 'g': case 'p': case 'n':
+            n++;
+            break;
+        case 'k':
+            n += 2; // fraction bits, value
+            break;
+        case 'h':
+            if(sp.raw == 'H') n += 2; // byte count, buffer
+    }
+    return n;
+}
+
+// same state machine as _vprintf - returns the number of specs, and fills out if it is not NULL
+constexpr size_t fmt_parse(const char * f, fmt_spec * out) {
+    size_t n = 0;
+    size_t i = 0;
+    size_t lit = 0;
+    for(;;) {
+        if(f[i] && f[i] != '%') {
+            i++;
+            continue;
+        }
+        fmt_spec sp = {};
+        sp.lit = lit;
+        sp.litn = i - lit;
+        if(f[i]) {
+            i++;
+            sp.prec = 255;
+            // flags
+            for(;; i++) {
+                if(f[i] == '#') sp.flags |= FLAG_ALT;
+                else if(f[i] == '0') sp.flags |= FLAG_0;
+                else if(f[i] == '-') sp.flags |= FLAG_MINUS;
+                else if(f[i] == ' ') sp.flags |= FLAG_SPACE;
+                else if(f[i] == '+') sp.flags |= FLAG_PLUS;
+                else if(f[i] == '\'') sp.flags |= FLAG_SHORT;
+                else if(f[i] != 'I') break;
+            }
+            // width
+            if(f[i] == '*') {
+                sp.star |= 1;
+                i++;
+            } else {
+                while(fmt_isdigit(f[i])) sp.width = sp.width * 10 + (f[i++] - '0');
+                if(f[i] == '$') sp.width = 0;
+            }
+            // precision
+            if(f[i] == '.') {
+                i++;
+                if(f[i] == '*') {
+                    sp.star |= 2;
+                    i++;
+                } else {
+                    sp.prec = 0;
+                    if(f[i] == '-') {
+                        sp.prec = 255;
+                        i++;
+                    }
+                    while(fmt_isdigit(f[i])) sp.prec = sp.prec * 10 + (f[i++] - '0');
+                    if(f[i] == '$') sp.prec = 255;
+                }
+            }
+            // modifier
+            switch(f[i]) {
+                case 'h': sp.mod = f[i + 1] == 'h' ? (i++, 'H') : 'h'; i++; break;
+                case 'l': sp.mod = f[i + 1] == 'l' ? (i++, 'q') : 'l'; i++; break;
+                case 'q': case 'L': case 'j': sp.mod = f[i++]; break;
+                case 'Z': sp.mod = 'z'; i++; break;
+            }
+            // conversion
+            if(f[i]) {
+                char c = f[i++];
+                sp.raw = c;
+                if(c >= 'A' && c <= 'Z') {
+                    sp.flags |= FLAG_CAP;
+                    c += 'a' - 'A';
+                }
+                if(c == 'h' && sp.mod == 'h') sp.flags &= ~FLAG_CAP; // %hH - lower case hex
+                if(sp.flags & FLAG_MINUS) sp.flags &= ~FLAG_0;
+                if(c == 'd') c = 'i';
+                if(c == 'a') c = 'e';
+                sp.conv = c;
+            }
+            lit = i;
+        }
+        if(out) out[n] = sp;
+        n++;
+        if(!f[i]) break;
+    }
+    return n;
+}
+
+template<size_t N> constexpr fmt_specs<N> fmt_build(const char * f) {
+    fmt_specs<N> r = {};
+    fmt_parse(f, r.s);
+    return r;
+}
+
+template<typename F> struct fmt_table {
+    static constexpr size_t count = fmt_parse(F::str(), nullptr);
+    static constexpr fmt_specs<count> specs = fmt_build<count>(F::str());
+    // index of the first argument used by spec k
+    static constexpr size_t arg(size_t k) {
+        size_t n = 0;
+        for(size_t i = 0; i < k; i++) n += fmt_argc(specs.s[i]);
+        return n;
+    }
+};
+
+template<typename T> constexpr bool fmt_int() {
+    typedef typename std::decay<T>::type D;
+    return std::is_integral<D>::value || std::is_enum<D>::value;
+}
+
+template<typename F, size_t K, typename Tuple>
+inline int fmt_run(pint_t * pint, int ret, const Tuple & args) {
+    typedef fmt_table<F> T;
+    if constexpr (K < T::count) {
+        constexpr fmt_spec sp = T::specs.s[K];
+        constexpr size_t w = T::arg(K);
+        constexpr size_t p = w + (sp.star & 1 ? 1 : 0);
+        constexpr size_t v = p + (sp.star & 2 ? 1 : 0);
+        if constexpr (sp.litn > 0) ret += _putn(pint, F::str() + sp.lit, sp.litn);
+        if constexpr (sp.conv != 0) {
+            pint->radix = 10;
+            pint->flags = sp.flags;
+            pint->width = sp.width;
+            pint->prec = sp.prec;
+            if constexpr (sp.star & 1) {
+                static_assert(fmt_int<std::tuple_element_t<w, Tuple>>(), "LibC::printf: * width needs an int");
+                int i = std::get<w>(args);
+                if(i < 0) {
+                    pint->flags |= FLAG_MINUS;
+                    pint->flags &= ~FLAG_0;
+                    pint->width = -i;
+                } else {
+                    pint->width = i;
+                }
+            }
+            if constexpr (sp.star & 2) {
+                static_assert(fmt_int<std::tuple_element_t<p, Tuple>>(), "LibC::printf: * precision needs an int");
+                int i = std::get<p>(args);
+                pint->prec = i < 0 ? 255 : i;
+            }
+            if constexpr (sp.conv == 's') {
+                static_assert(std::is_convertible<std::tuple_element_t<v, Tuple>, const char *>::value, "LibC::printf: %s needs a string");
+                ret += _prints(pint, (char *)(const char *)std::get<v>(args));
+            } else if constexpr (sp.conv == 'c') {
+                static_assert(fmt_int<std::tuple_element_t<v, Tuple>>(), "LibC::printf: %c needs an integer");
+                char c = std::get<v>(args);
+                ret += _putn(pint, &c, 1);
+            } else if constexpr (sp.conv == 'i' || sp.conv == 'o' || sp.conv == 'u' || sp.conv == 'x') {
+                static_assert(fmt_int<std::tuple_element_t<v, Tuple>>(), "LibC::printf: integer conversion needs an integer");
+                if constexpr (sizeof(std::get<v>(args)) > sizeof(unsigned int)) {
+                    ret += _printll(pint, (uint64_t)std::get<v>(args), sp.conv);
+                } else {
+                    ret += _printi(pint, (unsigned int)std::get<v>(args), sp.conv);
+                }
+            } else if constexpr (sp.conv == 'e' || sp.conv == 'f' || sp.conv == 'g') {
+                typedef typename std::decay<std::tuple_element_t<v, Tuple>>::type D;
+                static_assert(std::is_floating_point<D>::value, "LibC::printf: float conversion needs a float");
+                if constexpr (sp.mod == 'h' || (sp.flags & FLAG_SHORT && std::is_same<D, float>::value)) pint->flags |= FLAG_SINGLE;
+                ret += _printf(pint, std::get<v>(args), sp.conv);
+            } else if constexpr (sp.conv == 'k') {
+                static_assert(fmt_int<std::tuple_element_t<v, Tuple>>(), "LibC::printf: %k needs an int fraction bit count");
+                static_assert(fmt_int<std::tuple_element_t<v + 1, Tuple>>(), "LibC::printf: %k needs an integer value");
+                ret += _printk(pint, (uint64_t)(int64_t)std::get<v + 1>(args), std::get<v>(args), sp.conv);
+            } else if constexpr (sp.conv == 'h' && sp.raw == 'H') {
+                static_assert(fmt_int<std::tuple_element_t<v, Tuple>>(), "LibC::printf: %H needs an int byte count");
+                static_assert(std::is_pointer<typename std::decay<std::tuple_element_t<v + 1, Tuple>>::type>::value, "LibC::printf: %H needs a pointer");
+                ret += _printh(pint, (const uint8_t *)std::get<v + 1>(args), std::get<v>(args));
+            } else if constexpr (sp.conv == 'p') {
+                static_assert(std::is_pointer<typename std::decay<std::tuple_element_t<v, Tuple>>::type>::value, "LibC::printf: %p needs a pointer");
+                pint->flags = FLAG_0 | FLAG_ALT;
+                pint->width = 8;
+                pint->prec = 255;
+                ret += _printi(pint, (uint32_t)(uintptr_t)std::get<v>(args), 'x');
+            } else if constexpr (sp.conv == 'm') {
+                pint->flags = 0;
+                pint->width = 0;
+                pint->prec = 255;
+                ret += _printi(pint, errno, 'd');
+            } else if constexpr (sp.conv == 'n') {
+                typedef typename std::decay<std::tuple_element_t<v, Tuple>>::type P;
+                static_assert(std::is_pointer<P>::value && fmt_int<typename std::remove_pointer<P>::type>(), "LibC::printf: %n needs a pointer to an integer");
+                *std::get<v>(args) = ret;
+            } else {
+                // not a conversion - output it
+                char c = sp.raw;
+                ret += _putn(pint, &c, 1);
+            }
+        }
+        return fmt_run<F, K + 1>(pint, ret, args);
+    } else {
+        return ret;
+    }
+}
+
+template<typename F, typename... Args>
+int printf(Print& p, F, Args&&... args) {
+    static_assert(fmt_table<F>::arg(fmt_table<F>::count) == sizeof...(Args), "LibC::printf: argument count does not match the format");
+    pstream_t ps;
+    pint_t * pint = _pstream_init(&ps, &p);
+    int ret = fmt_run<F, 0>(pint, 0, std::forward_as_tuple(args...));
+    _pend(pint);
+    return ret;
+}
+
+template<typename F, typename... Args>
+int snprintf(char * str, size_t size, F, Args&&... args) {
+    static_assert(fmt_table<F>::arg(fmt_table<F>::count) == sizeof...(Args), "LibC::snprintf: argument count does not match the format");
+    pint_t pint = {0};
+    pint.sptr = str;
+    pint.scnt = str ? size : 0; // NULL only measures
+    int ret = fmt_run<F, 0>(&pint, 0, std::forward_as_tuple(args...));
+    _pend(&pint);
+    return ret;
+}
+
+}
+
+#endif
@@ -24,12 +24,34 @@
 
 #include "local_printf.h"
 
-#ifndef LIBC_PRINTF_NOFLOAT
-#error LIBC_PRINTF_NOFLOAT must be defined before include LibC_printf.h
+#if !defined(LIBC_PRINTF_NOFLOAT) && !defined(LIBC_PRINTF_NOLL) && !defined(LIBC_PRINTF_NOFIXED) && !defined(LIBC_PRINTF_NOHEX)
+#error LIBC_PRINTF_NOFLOAT, LIBC_PRINTF_NOLL, LIBC_PRINTF_NOFIXED and/or LIBC_PRINTF_NOHEX must be defined before include LibC_printf.h
 #endif
 
-extern "C" int _printf(pint_t * pint, float fnum, char fmt) {
+#ifdef LIBC_PRINTF_NOFLOAT
+extern "C" int _printf(pint_t * pint, double fnum, char fmt) {
     return 0;
 }
+#endif
+
+#ifdef LIBC_PRINTF_NOLL
+extern "C" int _printi(pint_t * pint, unsigned int num, char fmt);
+// truncate 64 bit ints to 32 bits
+extern "C" int _printll(pint_t * pint, uint64_t num, char fmt) {
+    return _printi(pint, (unsigned int)num, fmt);
+}
+#endif
+
+#ifdef LIBC_PRINTF_NOFIXED
+extern "C" int _printk(pint_t * pint, uint64_t num, int bits, char fmt) {
+    return 0;
+}
+#endif
+
+#ifdef LIBC_PRINTF_NOHEX
+extern "C" int _printh(pint_t * pint, const uint8_t * buf, int len) {
+    return 0;
+}
+#endif
 
 #endif
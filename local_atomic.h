@@ -0,0 +1,67 @@
+/*
+ * Copyright 2018 Justin Schoeman
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+ * software and associated documentation files (the "Software"), to deal in the Software 
+ * without restriction, including without limitation the rights to use, copy, modify, 
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+ * permit persons to whom the Software is furnished to do so, subject to the following 
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _LOCAL_ATOMIC_H_
+#define _LOCAL_ATOMIC_H_
+
+#include <stdint.h>
+
+/* read-modify-write atomics for data shared with interrupts - the gcc __atomic builtins, except on ARMv6-M
+   (Cortex-M0/M0+), which has no exclusive access instructions: there gcc turns them into __atomic_*_N library
+   calls which newlib does not provide, so they run with interrupts masked instead */
+#if defined(__ARM_ARCH_6M__) || defined(__ARM_ARCH_8M_BASE__)
+static inline uint32_t _atomic_lock(void) {
+    uint32_t pm;
+    __asm__ volatile("mrs %0, primask\n\tcpsid i" : "=r"(pm) :: "memory");
+    return pm;
+}
+static inline void _atomic_unlock(uint32_t pm) {
+    __asm__ volatile("msr primask, %0" :: "r"(pm) : "memory");
+}
+// swap in v, returns the old value
+#define LIBC_ATOMIC_XCHG(p, v) ({ \
+    uint32_t _pm = _atomic_lock(); \
+    __typeof__(*(p)) _o = *(p); \
+    *(p) = (v); \
+    _atomic_unlock(_pm); \
+    _o; })
+// if *p == *e set it to d and return 1, else load *p into *e and return 0
+#define LIBC_ATOMIC_CAS(p, e, d) ({ \
+    uint32_t _pm = _atomic_lock(); \
+    int _ok = *(p) == *(e); \
+    if(_ok) *(p) = (d); \
+    else *(e) = *(p); \
+    _atomic_unlock(_pm); \
+    _ok; })
+// add v, returns the new value
+#define LIBC_ATOMIC_ADD(p, v) ({ \
+    uint32_t _pm = _atomic_lock(); \
+    __typeof__(*(p)) _n = *(p) + (v); \
+    *(p) = _n; \
+    _atomic_unlock(_pm); \
+    _n; })
+#else
+#define LIBC_ATOMIC_XCHG(p, v) __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+#define LIBC_ATOMIC_CAS(p, e, d) __atomic_compare_exchange_n(p, e, d, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#define LIBC_ATOMIC_ADD(p, v) __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST)
+#endif
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2018 Justin Schoeman
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+ * software and associated documentation files (the "Software"), to deal in the Software 
+ * without restriction, including without limitation the rights to use, copy, modify, 
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+ * permit persons to whom the Software is furnished to do so, subject to the following 
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _LOCAL_MALLOC_H_
+#define _LOCAL_MALLOC_H_
+
+/* lifetime hints for malloc_ex - long lived data is packed from the bottom of the heap, short lived
+   data from the top, so transient buffers do not fragment persistent allocations and can be trimmed
+   back cheaply */
+#define MALLOC_LONG_LIVED	0
+#define MALLOC_SHORT_LIVED	1
+
+/* uncomment to build the allocator hooks (malloc_sethooks) and the latency histogram - when not
+   defined the hooks compile to nothing */
+//#define MALLOC_HOOKS
+
+/* uncomment to build the sampling heap guard (malloc_guard_rate) */
+//#define MALLOC_GUARD
+
+#define MALLOC_OP_MALLOC	0
+#define MALLOC_OP_REALLOC	1
+#define MALLOC_OP_FREE		2
+#define MALLOC_OP_CREALLOC	3
+#define MALLOC_OP_COUNT		4
+
+/* passed to the pre and post hooks - cycles and walked are only valid in the post hook, ptr is the
+   pointer passed in (pre) or returned (post, except for free) */
+typedef struct {
+    void * ptr;
+    size_t size;
+    uint32_t cycles; // elapsed, as measured by malloc_cycles()
+    uint16_t walked; // number of chain headers visited
+    uint8_t op; // MALLOC_OP_*
+} malloc_hook_t;
+
+typedef void (*malloc_hook_fn)(malloc_hook_t * h);
+
+#endif
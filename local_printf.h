@@ -22,17 +22,118 @@
 #ifndef _LOCAL_PRINTF_H_
 #define _LOCAL_PRINTF_H_
 
+#include <stdarg.h>
+
+/* phexdump flags */
+#define HEXDUMP_OFFSET	0x01 // offset column
+#define HEXDUMP_ASCII	0x02 // printable characters column
+#define HEXDUMP_UPPER	0x04 // upper case hex
+
+/* pint_t flags */
+#define FLAG_ALT	0x00000001U
+#define FLAG_0		0x00000002U
+#define FLAG_MINUS	0x00000004U
+#define FLAG_SPACE	0x00000008U
+#define FLAG_PLUS	0x00000010U
+#define FLAG_SINGLE	0x00000020U // %hg - float, not double (was the unused FLAG_STRIP0)
+#define FLAG_CAP	0x00000040U
+#define FLAG_SHORT	0x00000080U // %'g - shortest round trip
+
+/* bytes staged for Print::write on stream output (printf/pprintf) - 0 to send one character at a time */
+#ifndef LIBC_PRINTF_BUFFER
+#define LIBC_PRINTF_BUFFER 32
+#endif
+#if LIBC_PRINTF_BUFFER > 255
+#error LIBC_PRINTF_BUFFER must be at most 255 (the staged count is a uint8_t)
+#endif
+/* uncomment to also flush the staging buffer at every newline */
+//#define LIBC_PRINTF_FLUSH_NL
+
+/* number of Print sinks printf can fan out to (printf_addsink) */
+#ifndef LIBC_PRINTF_SINKS
+#define LIBC_PRINTF_SINKS 4
+#endif
+
+/* number of user conversions (printf_register) - 0 to remove */
+#ifndef LIBC_PRINTF_CONVS
+#define LIBC_PRINTF_CONVS 4
+#endif
+
+/* streams pfopen can hand out (fprintf etc. on any Print) */
+#ifndef LIBC_PRINTF_FILES
+#define LIBC_PRINTF_FILES 2
+#endif
+/* uncomment to keep the libc FILE functions (fprintf, vfprintf, fputs, fputc, fwrite) - eg when fopen'd files
+   on a filesystem are written with them */
+//#define LIBC_PRINTF_NOFILE
+
+/* formats kept parsed (printf_precompile) - 0 removes the cache (and the lookup in every printf call) */
+#ifndef LIBC_PRINTF_CACHE
+#define LIBC_PRINTF_CACHE 0
+#endif
+/* specs (each with the literal run before it) kept per cached format - the trailing run takes an entry more */
+#ifndef LIBC_PRINTF_CACHE_SPECS
+#define LIBC_PRINTF_CACHE_SPECS 8
+#endif
+/* uncomment to also cache every format printf is called with, not only precompiled ones - entries are keyed
+   by address, so only safe if formats are never rewritten in place (no formats built in buffers) */
+//#define LIBC_PRINTF_CACHE_AUTO
+
+/* spare bytes added each time a StrBuf (and asprintf) grows - compact() returns them */
+#ifndef LIBC_STRBUF_STEP
+#define LIBC_STRBUF_STEP 32
+#endif
+
+/* largest deferred log record (plog) in bytes, built on the stack - max 256 */
+#ifndef LIBC_PLOG_RECORD
+#define LIBC_PLOG_RECORD 64
+#endif
+
 /* waayyyy too much state to pass around between functions - ends up using a lot of stack space pushing them 
    all the time - rather create one structure up front and use it everywhere... packed to keep it tight ARM
    has good byte access capability (even non-aligned) */
 typedef struct {
-    char * sptr; // pointer to (initial) start of output string (also mapped to Print pointer when scnt=-1
-    size_t scnt; // initial number of free bytes in above string (set to intmax for effective unlimited)
+    char * sptr; // pointer to (initial) start of output string (also mapped to Print pointer when scnt=-1, NULL for printf)
+    size_t scnt; // initial number of free bytes in above string (set to intmax for effective unlimited, 0 to only measure)
     uint8_t radix;
     uint8_t flags;
     uint8_t width;
     uint8_t prec;
 } __attribute__((packed)) pint_t;
 
+/* stream output (scnt=-1) - the pint_t with the staging buffer, so string output (sprintf etc.) does not carry
+   the buffer on its stack. A stream pint_t is always the pint of one of these - set up with _pstream_init */
+typedef struct {
+    pint_t pint;
+#if LIBC_PRINTF_BUFFER > 0
+    uint8_t bcnt; // bytes staged in buf
+    char buf[LIBC_PRINTF_BUFFER];
+#endif
+} __attribute__((packed)) pstream_t;
+
+/* stream output to Print p (NULL for the printf sinks) - the buffer itself is left as is */
+static inline pint_t * _pstream_init(pstream_t * ps, void * p) {
+    ps->pint.sptr = (char *)p;
+    ps->pint.scnt = (size_t)-1;
+    ps->pint.radix = 0;
+    ps->pint.flags = 0;
+    ps->pint.width = 0;
+    ps->pint.prec = 0;
+#if LIBC_PRINTF_BUFFER > 0
+    ps->bcnt = 0;
+#endif
+    return &ps->pint;
+}
+
+/* user conversion - consume the argument(s) with va_arg(*ap, ...), output with _putn/_prints/_printi/_printll,
+   and return the number of characters output. pint holds the width, precision and flags of the spec */
+typedef int (*printf_conv_fn)(pint_t * pint, va_list * ap);
+
+/* scale m * 10^e10 to a normalised 64 bit mantissa, returning the binary exponent (printf.c - shared with scanf) */
+#ifdef __cplusplus
+extern "C"
+#endif
+int _dscale(uint64_t * pf, uint64_t m, int e10);
+
 
 #endif
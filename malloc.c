@@ -26,6 +26,8 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include "local_malloc.h"
+#include "local_atomic.h"
 
 
 /*
@@ -58,6 +60,23 @@ void *tst_sbrk(intptr_t increment) {
 #define TESTFN(x) 
 #endif
 
+#ifdef MALLOC_HOOKS
+#define HOOKFN(x) x
+static uint16_t hook_walked;
+#else
+#define HOOKFN(x)
+#endif
+
+static void *_realloc(void *ptr, size_t size, int flags);
+#ifdef MALLOC_GUARD
+#define GUARDFN(x) x
+static void * guard_tag; // return address of the current public entry point
+static void *_guarded(void *ptr, size_t size, int flags);
+#else
+#define GUARDFN(x)
+#define _guarded(ptr, size, flags) _realloc(ptr, size, flags)
+#endif
+
 /*
     we assume we are the only dynamic allocator on the system - if
     something fragments our space, then die...
@@ -84,7 +103,8 @@ void * __attribute__((weak)) safe_sbrk(int size) {
 
 /*
     header is precisely 32 bits
-    23..0 is allocation size
+    22..0 is allocation size
+    23 is short lived hint
     25..24 is extra size
     ...
     29..26 guard bits in test mode
@@ -95,7 +115,8 @@ void * __attribute__((weak)) safe_sbrk(int size) {
     single linked list
 */
 typedef uint32_t hdr_t;
-#define HDR_SIZE_MASK  		0x00ffffffU
+#define HDR_SIZE_MASK  		0x007fffffU
+#define HDR_SHORT_MASK		0x00800000U
 #define HDR_END_MASK 		0x80000000U
 #define HDR_FREE_MASK 		0x40000000U
 #define HDR_GUARD_MASK		0x3c000000U
@@ -107,13 +128,14 @@ static inline size_t hdr_pad_size(hdr_t * h) { return (*h & HDR_PAD_MASK) >> HDR
 static inline size_t hdr_data_size(hdr_t * h) { return (*h & HDR_SIZE_MASK) - hdr_pad_size(h); }
 static inline int hdr_free(hdr_t * h) { return *h & HDR_FREE_MASK; }
 static inline int hdr_end(hdr_t * h) { return *h & HDR_END_MASK; }
+static inline int hdr_short(hdr_t * h) { return *h & HDR_SHORT_MASK; }
 static inline void * hdr_data(hdr_t * h) { return (void*)((char*)h + sizeof(hdr_t)); }
 static inline hdr_t * hdr_hdr(void * d) { return (hdr_t*)((char*)d - sizeof(hdr_t)); }
 static inline hdr_t * hdr_next(hdr_t * h) { return (hdr_t *)((char*)h + hdr_size(h) + sizeof(hdr_t)); }
 static inline int hdr_check_guard(hdr_t * h) { return (*h & HDR_GUARD_MASK) == HDR_GUARD_VAL;}
 
 static inline void hdr_clear_free(hdr_t * h) { *h &= ~HDR_FREE_MASK; }
-static inline void hdr_set_free(hdr_t * h) { *h |= HDR_FREE_MASK; *h &= ~HDR_PAD_MASK; } // sanity check - just clear padding when free...
+static inline void hdr_set_free(hdr_t * h) { *h |= HDR_FREE_MASK; *h &= ~(HDR_PAD_MASK|HDR_SHORT_MASK); } // sanity check - just clear padding and hint when free...
 static inline void hdr_clear_end(hdr_t * h) { *h &= ~HDR_END_MASK; }
 static inline void hdr_set_end(hdr_t * h) { *h |= HDR_END_MASK; }
 
@@ -146,10 +168,82 @@ static void hdr_split(hdr_t * h, size_t size) {
     }
 }
 
+/* take size bytes from the top of free header h, leaving the rest free below it - returns the new (used) header */
+static hdr_t * hdr_split_high(hdr_t * h, size_t size) {
+    int extra = hdr_size(h) - size;
+    // no space for a new header below? then just use the whole block
+    if(extra < sizeof(hdr_t)) {
+        hdr_clear_free(h);
+        hdr_split(h, size);
+        return h;
+    }
+    hdr_t * newhdr = (hdr_t*)((char*)h + extra);
+    *newhdr = size | HDR_GUARD_VAL;
+    // move end, if required
+    if(hdr_end(h)) {
+        hdr_clear_end(h);
+        hdr_set_end(newhdr);
+    }
+    *h -= size + sizeof(hdr_t);
+    TESTFN(fprintf(stderr, "SPLIT HIGH: %08X %p %08X %p\n", *h, h, *newhdr, newhdr);)
+    return newhdr;
+}
+
+/*
+    deferred free queue - free_deferred() claims a slot with a single compare and swap, so it can be
+    called from interrupt context without touching the chain. The queue is drained at the start of
+    the next allocator call from the main context.
+    set to 0 to remove
+*/
+#ifndef MALLOC_DEFER_SLOTS
+#define MALLOC_DEFER_SLOTS 8
+#endif
+
+#if MALLOC_DEFER_SLOTS > 0
+static void * volatile defer_slot[MALLOC_DEFER_SLOTS];
+static volatile uint8_t defer_pending = 0;
+
+static void defer_drain(void) {
+    int i;
+    defer_pending = 0; // clear first - anything queued from here on will be caught now or on the next call
+    for(i = 0; i < MALLOC_DEFER_SLOTS; i++) {
+        void * ptr = LIBC_ATOMIC_XCHG(&defer_slot[i], NULL);
+        if(ptr) {
+            TESTFN(fprintf(stderr, "DEFERRED FREE %p\n", ptr);)
+            _guarded(ptr, 0, MALLOC_LONG_LIVED);
+        }
+    }
+}
+
+// queue ptr to be freed - returns 0 if the queue is full (ptr is not freed, try again later)
+int FNPRE(free_deferred)(void *ptr) {
+    int i;
+    if(!ptr) return 1;
+    for(i = 0; i < MALLOC_DEFER_SLOTS; i++) {
+        void * empty = NULL;
+        if(LIBC_ATOMIC_CAS(&defer_slot[i], &empty, ptr)) {
+            defer_pending = 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+#endif
+
 static hdr_t * base = NULL;
-void *FNPRE(realloc)(void *ptr, size_t size) {
+/*
+    flags is only used for new allocations - realloc of an existing pointer keeps its own hint
+    long lived data packs up from the bottom of the heap (lowest fit), short lived data is taken
+    from the top of the highest fit, so it can be tail trimmed as soon as it is released
+*/
+static void *_realloc(void *ptr, size_t size, int flags) {
+#if MALLOC_DEFER_SLOTS > 0
+    if(defer_pending) defer_drain();
+#endif
     // special case
     if(!ptr && !size) return NULL; // null ptr, 0 size = return NULL (free of 0 = noop, malloc of 0 = optional null ret)
+    if(ptr) flags = hdr_short(hdr_hdr(ptr)) ? MALLOC_SHORT_LIVED : MALLOC_LONG_LIVED;
+    hdr_t life = flags & MALLOC_SHORT_LIVED ? HDR_SHORT_MASK : 0;
     // sanity check 
     if(size > HDR_SIZE_MASK/2) {
         TESTFN(fprintf(stderr, "OOM(pretest) %zu\n", size);)
@@ -171,7 +265,7 @@ void *FNPRE(realloc)(void *ptr, size_t size) {
         }
         base = (hdr_t*)newbase;
         // set size, not empty, and chain end...
-        *base = size | HDR_END_MASK | HDR_GUARD_VAL;
+        *base = size | life | HDR_END_MASK | HDR_GUARD_VAL;
         return hdr_data(base);
     }
     // walk the chain
@@ -184,6 +278,7 @@ void *FNPRE(realloc)(void *ptr, size_t size) {
     hdr_t * prevhdr = NULL;
     hdr_t * nexthdr;
     for(;;) {
+        HOOKFN(hook_walked++;)
         TESTFN(fprintf(stderr, "ITER: %08X %p %d %d %zu\n", *tailhdr, tailhdr, hdr_end(tailhdr)?1:0, hdr_free(tailhdr)?1:0, hdr_size(tailhdr));)
         // check guard - possibly remove from production
         if(!hdr_check_guard(tailhdr)) {
@@ -196,6 +291,8 @@ void *FNPRE(realloc)(void *ptr, size_t size) {
         }
         // we are searching for free space, and this is free space?
         if(size && hdr_free(tailhdr) && hdr_size(tailhdr) >= size) {
+            // short lived - always take the highest fit
+            if(life) freehdr = tailhdr;
             // special case - if it is an exact size match, and lower in heap, force use
             // was going to allow a 3 byte margin, but pathalogic cases would result in a proliferation of pads...
             if(hdr_size(tailhdr) == size) {
@@ -246,12 +343,12 @@ void *FNPRE(realloc)(void *ptr, size_t size) {
         // required space (note: if any lower header was big enough we will move it there - this is just if we
         // need to try grow the current pointer up or down...
         // This is ludicrously expensive given how infrequently it is used - reevaluate!
-        if(!freehdr || freehdr > ptrhdr) {
-            // realloc,  did not find existing free space, or it would result in moving up the heap
+        if(!freehdr || (life ? freehdr < ptrhdr : freehdr > ptrhdr)) {
+            // realloc,  did not find existing free space, or it would result in moving up (down if short lived) the heap
             // see if we can grow the existing block up and/or down and/or extend
             size_t freesize = hdr_size(ptrhdr); // existing block can always be reused...
-            if(prevhdr && hdr_free(prevhdr)) {
-                // if prevhdr is free, we will always use it too
+            if(!life && prevhdr && hdr_free(prevhdr)) {
+                // if prevhdr is free, we will always use it too (never move short lived data down)
                 freesize += hdr_size(prevhdr) + sizeof(hdr_t); // only one header in final block
             } else {
                 prevhdr = NULL; // not using prevhdr
@@ -284,7 +381,7 @@ void *FNPRE(realloc)(void *ptr, size_t size) {
                 // create new headers before moving data, as the move may overwrite intermediate headers
                 // size is the total free size - set guard and copy end flag from highest included block
                 // size already checked, so should be no overflow
-                hdr_t tmphdr = freesize | HDR_GUARD_VAL;
+                hdr_t tmphdr = freesize | life | HDR_GUARD_VAL;
                 if(hdr_end(ptrhdr) || (nexthdr && hdr_end(nexthdr))) hdr_set_end(&tmphdr);
                 if(prevhdr) {
                     // move down to prevhdr, if required
@@ -334,6 +431,13 @@ void *FNPRE(realloc)(void *ptr, size_t size) {
         hdr_clear_end(tailhdr);
     }
     // finally, use freehdr...
+    if(life) {
+        freehdr = hdr_split_high(freehdr, size);
+    } else {
+        hdr_clear_free(freehdr);
+        hdr_split(freehdr, size);
+    }
+    *freehdr |= life;
     if(ptrhdr) {
         // realloc - move and free
         // non-overlapping, using memcopy
@@ -341,8 +445,6 @@ void *FNPRE(realloc)(void *ptr, size_t size) {
         hdr_set_free(ptrhdr);
     }
     ptrhdr = freehdr;
-    hdr_clear_free(ptrhdr);
-    hdr_split(ptrhdr, size);
     // fall through to done...
 
 done:
@@ -350,6 +452,7 @@ done:
     tailhdr = base;
     prevhdr = NULL;
     for(;;) {
+        HOOKFN(hook_walked++;)
         TESTFN(fprintf(stderr, "REWALK: %08X %p %d %d %zu\n", *tailhdr, tailhdr, hdr_end(tailhdr)?1:0, hdr_free(tailhdr)?1:0, hdr_size(tailhdr));)
         // check guard - possibly remove from production
         if(!hdr_check_guard(tailhdr)) {
@@ -393,36 +496,232 @@ done:
     return ptrhdr ? hdr_data(ptrhdr) : NULL;
 }
 
-// bubble down extension - realloc to existing size (possibly moving down the heap)
+#ifdef MALLOC_GUARD
+/*
+    sampling guard - every guard_rate'th new allocation is padded with canary filled red zones, which
+    are checked when it is released. Released samples are poisoned and held in quarantine, and the
+    poison is checked again when they are finally freed. Hits are reported (with the size and the
+    return address of the allocating call) through _malloc_guard_report before faulting.
+*/
+#define GUARD_SLOTS		8 // live samples
+#define GUARD_QUARANTINE	4 // released samples held back
+#define GUARD_ZONE		8 // red zone bytes either side
+#define GUARD_CANARY		0xa5
+#define GUARD_POISON		0xdb
+
+typedef struct {
+    char * ptr; // user pointer (GUARD_ZONE above the real allocation)
+    size_t size;
+    void * tag;
+} guard_t;
+
+static guard_t guard_live[GUARD_SLOTS];
+static guard_t guard_quar[GUARD_QUARANTINE];
+static uint8_t guard_qnext = 0;
+static uint16_t guard_rate = 0;
+static uint16_t guard_count = 0;
+TESTFN(int guard_hits = 0;)
+
+extern void _malloc_guard_report(const char * what, void * ptr, size_t size, void * tag);
+
+static void guard_fail(const char * what, guard_t * g) {
+    _malloc_guard_report(what, g->ptr, g->size, g->tag);
+    TESTFN(guard_hits++; return;)
+    *(int*)0 = 0;
+}
+
+static int guard_check(char * p, size_t n, uint8_t val) {
+    while(n--) if((uint8_t)*(p++) != val) return 0;
+    return 1;
+}
+
+static guard_t * guard_find(guard_t * g, int n, void * ptr) {
+    for(; n > 0; n--, g++) if(g->ptr == ptr) return g; // ptr NULL finds an empty slot
+    return NULL;
+}
+
+// really free a quarantined sample
+static void guard_evict(guard_t * g) {
+    if(!g->ptr) return;
+    if(!guard_check(g->ptr - GUARD_ZONE, g->size + 2 * GUARD_ZONE, GUARD_POISON)) guard_fail("USE AFTER FREE", g);
+    _realloc(g->ptr - GUARD_ZONE, 0, MALLOC_LONG_LIVED);
+    g->ptr = NULL;
+}
+
+// sample every n'th allocation (0 to disable sampling and release the quarantine)
+void FNPRE(malloc_guard_rate)(uint16_t n) {
+    guard_rate = guard_count = n;
+    if(!n) {
+        for(n = 0; n < GUARD_QUARANTINE; n++) guard_evict(&guard_quar[n]);
+    }
+}
+
+static void *_guarded(void *ptr, size_t size, int flags) {
+    guard_t * g;
+    if(!ptr) {
+        if(size && guard_rate && !--guard_count) {
+            guard_count = guard_rate;
+            g = guard_find(guard_live, GUARD_SLOTS, NULL);
+            if(g) {
+                char * real = _realloc(NULL, size + 2 * GUARD_ZONE, flags);
+                if(!real) return NULL;
+                memset(real, GUARD_CANARY, GUARD_ZONE);
+                memset(real + GUARD_ZONE + size, GUARD_CANARY, GUARD_ZONE);
+                g->ptr = real + GUARD_ZONE;
+                g->size = size;
+                g->tag = guard_tag;
+                TESTFN(fprintf(stderr, "GUARD SAMPLE %p %zu\n", g->ptr, size);)
+                return g->ptr;
+            }
+        }
+        return _realloc(NULL, size, flags);
+    }
+    g = guard_find(guard_quar, GUARD_QUARANTINE, ptr);
+    if(g) {
+        guard_fail("DOUBLE FREE", g);
+        return NULL;
+    }
+    g = guard_find(guard_live, GUARD_SLOTS, ptr);
+    if(!g) return _realloc(ptr, size, flags);
+    // sampled block
+    if(!guard_check(g->ptr - GUARD_ZONE, GUARD_ZONE, GUARD_CANARY)) guard_fail("UNDERFLOW", g);
+    if(!guard_check(g->ptr + g->size, GUARD_ZONE, GUARD_CANARY)) guard_fail("OVERFLOW", g);
+    char * ret = NULL;
+    if(size) {
+        // realloc - move to a normal block
+        ret = _realloc(NULL, size, hdr_short(hdr_hdr(g->ptr - GUARD_ZONE)) ? MALLOC_SHORT_LIVED : MALLOC_LONG_LIVED);
+        if(!ret) return NULL;
+        memcpy(ret, g->ptr, size < g->size ? size : g->size);
+    }
+    // poison and quarantine
+    memset(g->ptr - GUARD_ZONE, GUARD_POISON, g->size + 2 * GUARD_ZONE);
+    guard_evict(&guard_quar[guard_qnext]);
+    guard_quar[guard_qnext] = *g;
+    if(++guard_qnext >= GUARD_QUARANTINE) guard_qnext = 0;
+    g->ptr = NULL;
+    return ret;
+}
+#endif
+
+#ifdef MALLOC_HOOKS
+static malloc_hook_fn hook_pre = NULL;
+static malloc_hook_fn hook_post = NULL;
+
+/* default cycle counter for the hooks - the DWT cycle counter on cores that have one (the application
+   must enable it), override for other cores */
+uint32_t __attribute__((weak)) malloc_cycles(void) {
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+    return *(volatile uint32_t *)0xE0001004; // DWT->CYCCNT
+#else
+    return 0;
+#endif
+}
+
+/* set pre and/or post hooks (NULL to clear) - hooks must not call back into the allocator */
+void malloc_sethooks(malloc_hook_fn pre, malloc_hook_fn post) {
+    hook_pre = pre;
+    hook_post = post;
+}
+
+static void *_hooked(uint8_t op, void *ptr, size_t size, int flags) {
+    malloc_hook_t h = { ptr, size, 0, 0, op };
+    if(hook_pre) hook_pre(&h);
+    hook_walked = 0;
+    uint32_t t = malloc_cycles();
+    void * ret = _guarded(ptr, size, flags);
+    h.cycles = malloc_cycles() - t;
+    h.walked = hook_walked;
+    if(op != MALLOC_OP_FREE) h.ptr = ret;
+    if(hook_post) hook_post(&h);
+    return ret;
+}
+#else
+#define _hooked(op, ptr, size, flags) _guarded(ptr, size, flags)
+#endif
+
+void *FNPRE(realloc)(void *ptr, size_t size) {
+    GUARDFN(guard_tag = __builtin_return_address(0);)
+    return _hooked(MALLOC_OP_REALLOC, ptr, size, MALLOC_LONG_LIVED);
+}
+
+// bubble down extension - realloc to existing size (possibly moving down the heap, or up for short lived data)
 void *FNPRE(crealloc)(void *ptr) {
+    GUARDFN(if(guard_find(guard_live, GUARD_SLOTS, ptr)) return ptr;) // samples stay where they are
     hdr_t * hdr = hdr_hdr(ptr);
     if(!hdr_check_guard(hdr)) {
         TESTFN(fprintf(stderr, "CREALLOC HEADER GUARD FAIL AT %p (0x%x)\n", hdr, *hdr);)
         *(int*)0 = 0;
     }
-    void * ret = FNPRE(realloc)(ptr, hdr_data_size(hdr));
+    void * ret = _hooked(MALLOC_OP_CREALLOC, ptr, hdr_data_size(hdr), MALLOC_LONG_LIVED);
     return ret ? ret : ptr;
 }
 
 // If ptr is NULL, then the call is equivalent to malloc(size), for all values of size
 void *FNPRE(malloc)(size_t size) {
-    return FNPRE(realloc)(NULL, size);
+    GUARDFN(guard_tag = __builtin_return_address(0);)
+    return _hooked(MALLOC_OP_MALLOC, NULL, size, MALLOC_LONG_LIVED);
+}
+
+// malloc with a lifetime hint (MALLOC_LONG_LIVED or MALLOC_SHORT_LIVED)
+void *FNPRE(malloc_ex)(size_t size, int flags) {
+    GUARDFN(guard_tag = __builtin_return_address(0);)
+    return _hooked(MALLOC_OP_MALLOC, NULL, size, flags);
 }
 
 // if size is equal to zero, and ptr is not  NULL,  then  the  call  is  equivalent  to free(ptr).
 void FNPRE(free)(void *ptr) {
-    if(ptr) FNPRE(realloc)(ptr, 0);
+    if(ptr) _hooked(MALLOC_OP_FREE, ptr, 0, MALLOC_LONG_LIVED);
 }
 
 void *FNPRE(calloc)(size_t nmemb, size_t size) {
-    void * ret = FNPRE(realloc)(NULL, nmemb * size);
+    GUARDFN(guard_tag = __builtin_return_address(0);)
+    void * ret = _hooked(MALLOC_OP_MALLOC, NULL, nmemb * size, MALLOC_LONG_LIVED);
     if(ret && size > 0) bzero(ret, nmemb * size);
     return ret;
 }
 
+/*
+    reference counted blocks - a 32 bit count sits directly after the block header (so the data stays word
+    aligned), and the caller gets the data after it. Counts are updated atomically, so references may be taken
+    and dropped in interrupt handlers, but the last rc_release frees the block and must come from the main context
+*/
+typedef uint32_t rc_t;
+
+void *FNPRE(rc_alloc)(size_t size) {
+    GUARDFN(guard_tag = __builtin_return_address(0);)
+    rc_t * rc = _hooked(MALLOC_OP_MALLOC, NULL, size + sizeof(rc_t), MALLOC_LONG_LIVED);
+    if(!rc) return NULL;
+    *rc = 1;
+    return rc + 1;
+}
+
+// take another reference - returns ptr
+void *FNPRE(rc_retain)(void *ptr) {
+    if(!LIBC_ATOMIC_ADD((rc_t*)ptr - 1, 1)) {
+        TESTFN(fprintf(stderr, "RC OVERFLOW %p\n", ptr);)
+        *(int*)0 = 0;
+    }
+    return ptr;
+}
+
+// drop a reference, freeing the block when it was the last one - returns the remaining count
+int FNPRE(rc_release)(void *ptr) {
+    if(!ptr) return 0;
+    rc_t * rc = (rc_t*)ptr - 1;
+    rc_t ret = LIBC_ATOMIC_ADD(rc, -1);
+    if(ret == (rc_t)-1) {
+        // released more often than retained - the block is already free
+        TESTFN(fprintf(stderr, "RC UNDERFLOW %p\n", ptr);)
+        *(int*)0 = 0;
+    }
+    if(!ret) _hooked(MALLOC_OP_FREE, rc, 0, MALLOC_LONG_LIVED);
+    return ret;
+}
+
 // non-standard, but useful - ASSUMES ptr is a valid malloc return!!!
 size_t FNPRE(malloc_usable_size)(void *ptr) {
     if(!ptr) return 0;
+    GUARDFN(guard_t * g = guard_find(guard_live, GUARD_SLOTS, ptr); if(g) return g->size;)
     return hdr_data_size(hdr_hdr(ptr));
 }
 
@@ -518,6 +817,19 @@ void * bm(int i, size_t s) {
     return b[i];
 }
 
+// malloc with lifetime hint
+void * bmx(int i, size_t s, int flags) {
+    fprintf(stderr, "***** MALLOC_EX %d to %zu (%d)\n", i, s, flags);
+    assert(b[i] == 0);
+    b[i] = tst_malloc_ex(s, flags);
+    if(b[i]) {
+        bs[i] = s;
+        char * c = b[i];
+        while(s-- > 0) *(c++) = (i & 0xff);
+    }
+    return b[i];
+}
+
 // free
 void bf(int i) {
     fprintf(stderr, "***** FREE %d (%p) from %zu\n", i, b[i], bs[i]);
@@ -573,6 +885,21 @@ void bc(int i) {
     //exit(0);
 }
 
+#ifdef MALLOC_GUARD
+void _malloc_guard_report(const char * what, void * ptr, size_t size, void * tag) {
+    fprintf(stderr, "HEAP GUARD %s: %p size %zu from %p\n", what, ptr, size, tag);
+}
+#endif
+
+#ifdef MALLOC_HOOKS
+int hook_calls[MALLOC_OP_COUNT];
+uint16_t hook_walk_max;
+void hook_count(malloc_hook_t * h) {
+    hook_calls[h->op]++;
+    if(h->walked > hook_walk_max) hook_walk_max = h->walked;
+}
+#endif
+
 // reset - fee all allocated data and start clean
 void rst(void) {
     int i;
@@ -648,6 +975,35 @@ void stress(int scount) {
     }
 }
 
+// stress test for lifetime hints - short lived blocks between long lived ones, released sooner
+void stress_short(int scount) {
+    rst();
+    srandom(1);
+    while(scount-- > 0) {
+        int i = random() % BMAX;
+        int c = random() % 10;
+        if(b[i]) {
+            if(c < 5) {
+                bf(i);
+            } else if(c < 6) {
+                bc(i);
+            } else {
+                int s = random() % 200;
+                br(i, s);
+            }
+        } else if(c < 3) {
+            int s = random() % 200;
+            if(c) {
+                bmx(i, s, MALLOC_SHORT_LIVED);
+            } else {
+                bm(i, s);
+            }
+        }
+        mval();
+        rewrite();
+    }
+}
+
 // run crealloc on all data
 void cmpct(void) {
     int i;
@@ -701,9 +1057,107 @@ int main(void) {
     assert(br(1,26) == (char*)base + 4);
     assert(br(1,25) == (char*)base + 4);
     rst();
+
+    // short lived data is taken from the top of a hole, long lived from the bottom
+    assert(bm(0, 10) == (char*)base + 4);
+    assert(bm(1, 10) == (char*)base + 18);
+    assert(bm(2, 30) == (char*)base + 32);
+    assert(bm(3, 10) == (char*)base + 66);
+    bf(2);
+    assert(bmx(4, 10, MALLOC_SHORT_LIVED) == (char*)base + 52);
+    assert(bm(5, 10) == (char*)base + 32);
+    // crealloc must not bubble short lived data down
+    bf(1);
+    bc(4);
+    assert(b[4] == (char*)base + 52);
+    bc(5);
+    assert(b[5] == (char*)base + 18);
+    // short lived data at the top of the heap is trimmed as soon as it is released
+    assert(bmx(6, 20, MALLOC_SHORT_LIVED) == (char*)base + 80);
+    bf(6);
+    assert(safe_sbrk(0) == (char*)base + 76);
+    rst();
+
+    // reference counted blocks
+    {
+        char * c = tst_rc_alloc(10);
+        assert(c == (char*)base + 8);
+        memset(c, 0x5a, 10);
+        assert(tst_rc_retain(c) == c);
+        assert(tst_rc_retain(c) == c);
+        assert(tst_rc_release(c) == 2);
+        assert(tst_rc_release(c) == 1);
+        assert(c[9] == 0x5a);
+        assert(tst_rc_release(c) == 0);
+        assert(base == NULL);
+    }
+
+#if MALLOC_DEFER_SLOTS > 0
+    // deferred free - released on the next allocator call
+    assert(bm(0, 10) == (char*)base + 4);
+    assert(bm(1, 10) == (char*)base + 18);
+    assert(tst_free_deferred(b[0]));
+    b[0] = NULL;
+    assert(bm(2, 10) == (char*)base + 4);
+    // full queue is refused
+    for(i = 0; i <= MALLOC_DEFER_SLOTS; i++) assert(bm(10 + i, 10));
+    for(i = 0; i < MALLOC_DEFER_SLOTS; i++) {
+        assert(tst_free_deferred(b[10 + i]));
+        b[10 + i] = NULL;
+    }
+    assert(!tst_free_deferred(b[10 + i]));
+    rst();
+#endif
+
+#ifdef MALLOC_GUARD
+    {
+        char * c;
+        tst_malloc_guard_rate(1); // sample everything
+        bm(0, 10);
+        assert(tst_malloc_usable_size(b[0]) == 10);
+        b[0][10] = 0; // overflow
+        bf(0);
+        assert(guard_hits == 1);
+        bm(1, 10);
+        c = b[1];
+        bf(1);
+        assert(guard_hits == 1);
+        tst_free(c); // double free
+        assert(guard_hits == 2);
+        c[0] = 0; // use after free
+        for(i = 2; i < 2 + GUARD_QUARANTINE; i++) {
+            bm(i, 10);
+            bf(i);
+        }
+        assert(guard_hits == 3);
+        bm(0, 10);
+        assert(br(0, 20));
+        tst_malloc_guard_rate(0);
+        rst();
+        assert(guard_hits == 3);
+    }
+#endif
+
+#ifdef MALLOC_HOOKS
+    malloc_sethooks(NULL, hook_count);
+    bm(0, 10);
+    bm(1, 10);
+    br(0, 20);
+    bc(0);
+    bf(1);
+    bf(0);
+    malloc_sethooks(NULL, NULL);
+    assert(hook_calls[MALLOC_OP_MALLOC] == 2);
+    assert(hook_calls[MALLOC_OP_REALLOC] == 1);
+    assert(hook_calls[MALLOC_OP_CREALLOC] == 1);
+    assert(hook_calls[MALLOC_OP_FREE] == 2);
+    assert(hook_walk_max >= 3);
+#endif
     
     stress(1000);
     mval();
+    stress_short(1000);
+    mval();
     return;
     
     for(i = 0; i < 100; i++) {
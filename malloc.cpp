@@ -0,0 +1,83 @@
+/*
+ * Copyright 2018 Justin Schoeman
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+ * software and associated documentation files (the "Software"), to deal in the Software 
+ * without restriction, including without limitation the rights to use, copy, modify, 
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+ * permit persons to whom the Software is furnished to do so, subject to the following 
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include "LibC.h"
+
+#ifdef MALLOC_GUARD
+
+static Print * _malloc_guard_printer = NULL;
+
+void malloc_guard_setprint(Print * p) {
+    _malloc_guard_printer = p;
+}
+
+// called by the heap guard just before it faults
+extern "C" void _malloc_guard_report(const char * what, void * ptr, size_t size, void * tag) {
+    if(!_malloc_guard_printer) return;
+    pprintf(*_malloc_guard_printer, "HEAP GUARD %s: %p size %u from %p\n", what, ptr, (unsigned int)size, tag);
+    _malloc_guard_printer->flush();
+}
+
+#endif
+
+#ifdef MALLOC_HOOKS
+
+/* latency histogram - counts calls per operation in log2(cycles) buckets, and tracks the longest
+   chain walk per operation */
+#define MALLOC_HIST_BUCKETS 16
+
+static uint16_t _malloc_hist[MALLOC_OP_COUNT][MALLOC_HIST_BUCKETS];
+static uint16_t _malloc_hist_walk[MALLOC_OP_COUNT];
+
+static void _malloc_hist_post(malloc_hook_t * h) {
+    uint32_t c = h->cycles;
+    uint8_t b = 0;
+    while(c > 1 && b < MALLOC_HIST_BUCKETS - 1) {
+        c >>= 1;
+        b++;
+    }
+    if(_malloc_hist[h->op][b] != 0xffff) _malloc_hist[h->op][b]++; // saturate
+    if(h->walked > _malloc_hist_walk[h->op]) _malloc_hist_walk[h->op] = h->walked;
+}
+
+void malloc_hist_start(void) {
+    memset(_malloc_hist, 0, sizeof(_malloc_hist));
+    memset(_malloc_hist_walk, 0, sizeof(_malloc_hist_walk));
+    malloc_sethooks(NULL, _malloc_hist_post);
+}
+
+void malloc_hist_stop(void) {
+    malloc_sethooks(NULL, NULL);
+}
+
+void malloc_hist_report(Print& p) {
+    static const char * const names[MALLOC_OP_COUNT] = { "malloc", "realloc", "free", "crealloc" };
+    for(int op = 0; op < MALLOC_OP_COUNT; op++) {
+        pprintf(p, "%-8s walk<=%u", names[op], _malloc_hist_walk[op]);
+        for(int b = 0; b < MALLOC_HIST_BUCKETS; b++) {
+            if(_malloc_hist[op][b]) pprintf(p, " <2^%d:%u", b + 1, _malloc_hist[op][b]);
+        }
+        pprintf(p, "\n");
+    }
+}
+
+#endif
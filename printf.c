@@ -22,6 +22,9 @@
 /*
     Compile as follows to test...
     gcc -DTEST -Os -g -Wall -o printf printf.c -lm
+    
+    ...or to benchmark against glibc (ns per call and Mchars/s per conversion class, and code sizes)
+    gcc -DTEST -DBENCH -O2 -g -o printf_bench printf.c -lm
 */
 
 /*
@@ -34,10 +37,12 @@
     1. Output failures are not tracked/counted. Return value is the number of characters 
     that _should have_ been printed.
     
-    2. Limited precision - 64 bit ints are truncated to 32, doubles to floats
+    2. 64 bit ints are rendered by _printll, which can be replaced with a truncating version -
+    see LibC_printf.h
     
-    3. Floats are cast back to int32 for rendering - if there are two many digits, zeros
-    are appended (and possibly decimals are reduced) - PRECISION IS LOST ON LARGE FLOATS!
+    3. Doubles are converted to a 17-18 digit int64 for rendering - if there are two many digits, zeros
+    are appended - PRECISION IS LOST ON LARGE DOUBLES!  The ' flag (%'g) selects the shortest digits
+    which round trip instead, and h (%'hg) treats the value as a float
     
     4. targets 32 bit processors, so all modifiers which promote to int are ignored
     
@@ -48,16 +53,49 @@
     
     7. m$ width/precision are parsed, but treated as unset...
     
-    8. floating point precision is limited to 8 decimals
+    8. floating point precision is limited to 17 decimals (9 for floats)
     
     9. 'g' precision interpretation differs from gcc - can't understand gccs interpretation
     
     10. width is limited to 255, precision to 254
     
+    11. %H (not ISO) prints a buffer as hex - an int byte count then the pointer.  ' ' separates the
+    bytes, '#' adds 0X.  Upper case - %hH for lower case.  phexdump prints whole hex dump lines
+    
+    12. %k (not ISO) prints fixed point - an int fraction bit count (negative for a power of ten) then
+    the value, int32 or int64 with l/ll.  %K is unsigned.  Integer arithmetic only
+    
+    13. printf_register adds conversions - they are matched before the built in ones (case sensitive),
+    and a registered 'I' is no longer skipped as a flag
+    
+    14. plog (deferred logging) records are decoded by the TEST build: printf firmware.elf log.bin
+    
+    15. printf_precompile keeps a format parsed, keyed by its address - the same parser (_pspec) serves
+    both paths, so cached and uncached output can not differ
+    
 */
 
 //#define BUILD_A
 //#define ROUND_UP
+//#define SMALL_PUINT
+//#define SMALL_PSCAN
+
+// the word/SSE2 _pscan reads past the terminator (inside the aligned load) - fine on hardware, but ASan reports it
+#if defined(__SANITIZE_ADDRESS__) && !defined(SMALL_PSCAN)
+#define SMALL_PSCAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) && !defined(SMALL_PSCAN)
+#define SMALL_PSCAN
+#endif
+#endif
+
+#if defined(TEST) && !defined(LIBC_PRINTF_CACHE)
+#define LIBC_PRINTF_CACHE 4 // opt in, so the cache is tested
+#endif
+
+#ifdef BENCH
+#define _GNU_SOURCE // fopencookie for the glibc counting stream
+#endif
 
 #include <stdio.h>
 #include <stdarg.h>
@@ -67,21 +105,20 @@
 #include <stddef.h>
 #include <errno.h>
 #include <math.h>
+#include <limits.h>
 #include "local_printf.h"
-
-#define FLAG_ALT	0x00000001U
-#define FLAG_0		0x00000002U
-#define FLAG_MINUS	0x00000004U
-#define FLAG_SPACE	0x00000008U
-#define FLAG_PLUS	0x00000010U
-//#define FLAG_STRIP0	0x00000020U
-#define FLAG_CAP	0x00000040U
+#if defined(__SSE2__) && !defined(SMALL_PSCAN)
+#include <emmintrin.h>
+#endif
 
 
 #ifdef TEST
 #include <assert.h>
 #include <stdlib.h>
 #include <fenv.h>
+#include <elf.h>
+#include <unistd.h>
+#include <sys/uio.h>
 #define FNPRE(x) tst_ ## x
 #define TESTFN(x) x
 // need prototypes for test variants
@@ -92,8 +129,127 @@ int FNPRE(vprintf)(const char *format, va_list ap);
 int FNPRE(vsprintf)(char *str, const char *format, va_list ap);
 int FNPRE(vsnprintf)(char *str, size_t size, const char *format, va_list ap);
 int FNPRE(puts)(const char *s);
-// dummy for c test env
+int FNPRE(fprintf)(FILE * f, const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+int FNPRE(vfprintf)(FILE * f, const char *format, va_list ap);
+int FNPRE(fputs)(const char *s, FILE * f);
+int FNPRE(fputc)(int c, FILE * f);
+size_t FNPRE(fwrite)(const void * buf, size_t size, size_t n, FILE * f);
+int FNPRE(printf_register)(char c, printf_conv_fn fn);
+int FNPRE(printf_precompile)(const char * format);
+void FNPRE(printf_cache_stats)(uint32_t * hits, uint32_t * misses);
+// for formats gcc does not know (%k, %H, m$ ...) - no format attribute, so no -Wformat noise
+static int (* const tst_printf_nf)(const char *format, ...) = FNPRE(printf);
+static int (* const tst_snprintf_nf)(char *str, size_t size, const char *format, ...) = FNPRE(snprintf);
+// dummy for c test env - _tst_pfile is bound to a Print which collects in _tst_pout (as printf_setfile does)
+static FILE * _tst_pfile;
+static char _tst_pout[128];
+static int _tst_pcnt;
 void _pprintf_putchar(void * p, int c) {
+    if(p == _tst_pout && _tst_pcnt < (int)sizeof(_tst_pout)) _tst_pout[_tst_pcnt++] = c;
+}
+void * _pfile_print(FILE * f) {
+    if(f && f == _tst_pfile) return _tst_pout;
+    return f == stdout || f == stderr ? NULL : (void *)-1;
+}
+void _pprintf_write(void * p, const char * buf, int n) {
+    while(n-- > 0) _pprintf_putchar(p, *buf++);
+}
+
+/* host sink (simulators, log replay) - printf output is collected in a buffer and written to fd with writev,
+   the buffered text and the new chunk as two segments, so runs which do not fit are never copied */
+#define HOST_SINK_LINE 1 // write at every newline
+#define HOST_SINK_FULL 2 // write when the buffer is full (and at printf_hostflush / exit)
+#ifndef HOST_SINK_BUF
+#define HOST_SINK_BUF 4096
+#endif
+static struct {
+    int fd; // -1 - stdio stdout
+    uint8_t mode;
+    int used;
+    long writes; // writev calls
+    char buf[HOST_SINK_BUF];
+} _hsink = { .fd = -1 };
+
+// write the buffered text, then s[0..n) - in one writev unless it is short
+static void _hsink_writev(const char * s, int n) {
+    struct iovec iov[2];
+    int cnt = 0, e = errno; // keep errno for %m
+    if(_hsink.used) {
+        iov[cnt].iov_base = _hsink.buf;
+        iov[cnt++].iov_len = _hsink.used;
+    }
+    if(n) {
+        iov[cnt].iov_base = (void *)s;
+        iov[cnt++].iov_len = n;
+    }
+    while(cnt) {
+        ssize_t w = writev(_hsink.fd, iov, cnt);
+        if(w < 0 && errno == EINTR) continue;
+        if(w < 0) break;
+        _hsink.writes++;
+        for(; cnt && (size_t)w >= iov[0].iov_len; cnt--) {
+            w -= iov[0].iov_len;
+            iov[0] = iov[1];
+        }
+        if(cnt) {
+            iov[0].iov_base = (char *)iov[0].iov_base + w;
+            iov[0].iov_len -= w;
+        }
+    }
+    _hsink.used = 0;
+    errno = e;
+}
+
+void printf_hostflush(void) {
+    if(_hsink.fd >= 0 && _hsink.used) _hsink_writev(NULL, 0);
+}
+
+// send printf output to fd (HOST_SINK_LINE or HOST_SINK_FULL buffered) - fd -1 returns to stdio stdout
+void printf_hostsink(int fd, int mode) {
+    static int reg = 0;
+    if(!reg) reg = !atexit(printf_hostflush);
+    printf_hostflush();
+    fflush(stdout);
+    _hsink.fd = fd;
+    _hsink.mode = mode;
+}
+
+#ifdef BENCH
+static long _bench_chars = -1; // count stream output instead of writing it
+#endif
+void _printf_write(const char * buf, int n) {
+#ifdef BENCH
+    if(_bench_chars >= 0) {
+        _bench_chars += n;
+        return;
+    }
+#endif
+    if(_hsink.fd < 0) {
+        fwrite(buf, 1, n, stdout);
+        return;
+    }
+    if(n > HOST_SINK_BUF - _hsink.used) {
+        // does not fit - the chunk goes out behind the buffer without being copied
+        _hsink_writev(buf, n);
+        return;
+    }
+    memcpy(_hsink.buf + _hsink.used, buf, n);
+    _hsink.used += n;
+    if(_hsink.mode == HOST_SINK_LINE) {
+        // write up to the last newline, keep the rest
+        int k;
+        for(k = n; k && buf[k - 1] != '\n'; k--);
+        if(k) {
+            _hsink.used -= n - k;
+            _hsink_writev(NULL, 0);
+            memcpy(_hsink.buf, buf + k, n - k);
+            _hsink.used = n - k;
+        }
+    }
+}
+void _printf_putchar(int c) {
+    char ch = c;
+    _printf_write(&ch, 1);
 }
 #else
 #define FNPRE(x) x
@@ -115,88 +271,514 @@ int putchar(int c) {
 
 
 
-//output one chatacter at a time (whatever the destination...)
 extern void _pprintf_putchar(void * p, int c);
-static void _putc(pint_t * pint, int c) {
+extern void _pprintf_write(void * p, const char * buf, int n);
+extern void _printf_putchar(int c);
+extern void _printf_write(const char * buf, int n);
+
+// send anything staged for stream output
+static void _flush(pint_t * pint) {
+#if LIBC_PRINTF_BUFFER > 0
+    pstream_t * ps = (pstream_t *)pint;
+    if(!ps->bcnt) return;
     if(pint->sptr) {
-        if(pint->scnt == (size_t)-1) { // magic marker
-            _pprintf_putchar(pint->sptr, c);
-            return;
-        }
-        if(pint->scnt == 0) return; // buffer full
+        _pprintf_write(pint->sptr, ps->buf, ps->bcnt);
+    } else {
+        _printf_write(ps->buf, ps->bcnt);
+    }
+    ps->bcnt = 0;
+#endif
+}
+
+// string output is full, or we are only measuring (snprintf(NULL, 0, ...)) - conversions only need a length
+#define _pfull(pint) ((pint)->scnt == 0)
+
+//output one chatacter at a time (whatever the destination...)
+static void _putc(pint_t * pint, int c) {
+    if(pint->scnt != (size_t)-1) { // magic marker for Print output
+        if(_pfull(pint)) return; // buffer full
         if(pint->scnt == 1) c = 0; // always null terminate the string
         pint->scnt--; // use up one char
         *(pint->sptr++) = c;
+        return;
+    }
+#if LIBC_PRINTF_BUFFER > 0
+    pstream_t * ps = (pstream_t *)pint;
+    ps->buf[ps->bcnt++] = c;
+#ifdef LIBC_PRINTF_FLUSH_NL
+    if(c == '\n') _flush(pint);
+#endif
+    if(ps->bcnt >= LIBC_PRINTF_BUFFER) _flush(pint);
+#else
+    if(pint->sptr) {
+        _pprintf_putchar(pint->sptr, c);
     } else {
-        putchar(c);
+        _printf_putchar(c);
+    }
+#endif
+}
+
+// send n characters straight to the stream (bypassing the staging buffer)
+static void _pwrite(pint_t * pint, const char * s, int n) {
+    if(pint->sptr) {
+        _pprintf_write(pint->sptr, s, n);
+    } else {
+        _printf_write(s, n);
+    }
+}
+
+// output n characters from s - one memcpy for strings, one write for streams
+int _putn(pint_t * pint, const char * s, int n) {
+    int ret = n;
+    if(_pfull(pint) || n <= 0) return ret;
+    if(pint->scnt != (size_t)-1) {
+        if((size_t)n < pint->scnt) {
+            memcpy(pint->sptr, s, n);
+            pint->sptr += n;
+            pint->scnt -= n;
+        } else {
+            // truncated - fill up, and always null terminate the string
+            memcpy(pint->sptr, s, pint->scnt - 1);
+            pint->sptr += pint->scnt;
+            pint->sptr[-1] = 0;
+            pint->scnt = 0;
+        }
+        return ret;
+    }
+#if LIBC_PRINTF_BUFFER > 0
+    pstream_t * ps = (pstream_t *)pint;
+    if(ps->bcnt + n > LIBC_PRINTF_BUFFER) {
+        _flush(pint);
+        if(n >= LIBC_PRINTF_BUFFER) {
+            _pwrite(pint, s, n);
+            return ret;
+        }
+    }
+    memcpy(ps->buf + ps->bcnt, s, n);
+    ps->bcnt += n;
+#ifdef LIBC_PRINTF_FLUSH_NL
+    if(memchr(s, '\n', n)) _flush(pint);
+#endif
+    if(ps->bcnt >= LIBC_PRINTF_BUFFER) _flush(pint);
+#else
+    _pwrite(pint, s, n);
+#endif
+    return ret;
+}
+
+// output n copies of c - memset for strings and the staging buffer
+static void _fill(pint_t * pint, int c, int n) {
+    if(_pfull(pint) || n <= 0) return;
+    if(pint->scnt != (size_t)-1) {
+        if((size_t)n < pint->scnt) {
+            memset(pint->sptr, c, n);
+            pint->sptr += n;
+            pint->scnt -= n;
+        } else {
+            memset(pint->sptr, c, pint->scnt - 1);
+            pint->sptr += pint->scnt;
+            pint->sptr[-1] = 0;
+            pint->scnt = 0;
+        }
+        return;
+    }
+#if LIBC_PRINTF_BUFFER > 0
+    pstream_t * ps = (pstream_t *)pint;
+    while(n > 0) {
+        int k = LIBC_PRINTF_BUFFER - ps->bcnt;
+        if(k > n) k = n;
+        memset(ps->buf + ps->bcnt, c, k);
+        ps->bcnt += k;
+        n -= k;
+        if(ps->bcnt >= LIBC_PRINTF_BUFFER) _flush(pint);
+    }
+#ifdef LIBC_PRINTF_FLUSH_NL
+    if(c == '\n') _flush(pint);
+#endif
+#else
+    while(n-- > 0) _putc(pint, c);
+#endif
+}
+
+// finish output - null terminate string output, or send anything still staged
+void _pend(pint_t * pint) {
+    if(pint->scnt != (size_t)-1) {
+        _putc(pint, 0); // null terminate string output
+    } else {
+        _flush(pint);
     }
 }
 
 // uses up n!
 static int _padc(pint_t * pint, int c, int *n) {
-    int ret = 0;
-    while(*n > 0) {
-        _putc(pint, c);
-        (*n)--;
-        ret++;
-    }
+    int ret = *n;
+    if(ret <= 0) return 0;
+    _fill(pint, c, ret);
+    *n = 0;
     return ret;
 }
 
-static int _prints(pint_t * pint, char *s) {
+int _prints(pint_t * pint, char *s) {
+    int n;
     int pad = 0;
-    int ret = 0;
+    int ret;
     if(!s) s = "(null)";
-    if(pint->width > 0) {
-        // don't want to load strlen too...
-        for(pad = 0; (pint->prec == 255 || pad < pint->prec) && s[pad]; pad++);
-        if(pad < pint->width) {
-            pad = pint->width - pad;
+    // don't want to load strlen too...
+    for(n = 0; (pint->prec == 255 || n < pint->prec) && s[n]; n++);
+    if(n < pint->width) pad = pint->width - n;
+    ret = n + pad;
+    if(_pfull(pint)) return ret;
+    if(!(pint->flags & FLAG_MINUS)) _padc(pint, ' ', &pad);
+    _putn(pint, s, n);
+    _padc(pint, ' ', &pad);
+    return ret;
+}
+
+// output the leading padding and sign for a field of len characters (including the sign)
+// returns the field width, and leaves the trailing padding in pad
+static int _pfield(pint_t * pint, char padc, int len, int * pad) {
+    int ret;
+    if(pint->width > 0 && len < pint->width) {
+        *pad = pint->width - len;
+        ret = pint->width;
+    } else {
+        *pad = 0;
+        ret = len;
+    }
+    if(!(pint->flags & FLAG_MINUS)) {
+        if(pint->flags & FLAG_0) {
+            if(padc) _putc(pint, padc);
+            padc = 0;
+            _padc(pint, '0', pad);
         } else {
-            pad = 0;
+            _padc(pint, ' ', pad);
         }
     }
-    if(!(pint->flags & FLAG_MINUS)) _padc(pint, ' ', &pad);
-    while(*s) {
-        if(pint->prec != 255 && ret >= pint->prec) break;
-        _putc(pint, *(s++));
-        ret++;
-    }
-    _padc(pint, ' ', &pad);
-    return ret + pad;
+    if(padc) _putc(pint, padc);
+    return ret;
 }
 
-// print an integer.  if dummy is true then only count the number of digits which would be output
-// was trying to be 'eficient' by doing this without temp storage, but the cost in flash is way
-// too high considering the stack saving.
-// at worst 32 bit octal will be 11 digits, plus the one potential decimal (which can't happen with octal
-// but is a potential input, so cater for it...)
-// DECS MUST NEVER BE BIGGER THAN 10
-static int _puint(pint_t * pint, uint32_t num, int decs, int dummy) {
-    int8_t tmp[12];
+// convert num to ascii digits in tmp, least significant first - returns the number of digits
+// at worst 32 bit octal will be 11 digits
+#ifdef SMALL_PUINT
+// flash minimal - one runtime divide per digit
+static int _utoa(pint_t * pint, uint32_t num, char * tmp) {
+    int8_t hofs = pint->flags & FLAG_CAP ? 'A' - ':' : 'a' - ':';
     int ret = 0;
-    
-    for(;;) {
-        TESTFN(if(ret >= 12) *(int*)0=0;)
-        TESTFN(if(decs >= 10) *(int*)0=0;)
-        // always output first digit
-        tmp[ret++] = num % pint->radix;
+    do {
+        char c = num % pint->radix + '0';
         num /= pint->radix;
-        if(!--decs) tmp[ret++] = '.' - '0'; // decs won't wrap back to zero again, so cheap test
-        if(decs >= 0) continue; // if we have output a decimal, we must output at least one more
-        if(!num) break;
-    }
-    if(dummy) return ret;
-    // now spit em out in reverse order
-    for(decs = ret - 1; decs >= 0; decs--) {
-        int8_t hofs = pint->flags & FLAG_CAP ? 'A' - ':' : 'a' - ':';
-        dummy = tmp[decs];
-        dummy += '0';
-        if(dummy > '9') dummy += hofs;
-        _putc(pint, dummy);
+        if(c > '9') c += hofs;
+        tmp[ret++] = c;
+    } while(num);
+    return ret;
+}
+#else
+// radix specialised - shift and mask for hex/octal, two digits at a time for decimal
+static int _utoa(pint_t * pint, uint32_t num, char * tmp) {
+    static const char hex[] = "0123456789abcdef0123456789ABCDEF";
+    static const char dec2[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    const char * d;
+    int ret = 0;
+    if(pint->radix != 10) {
+        // 8 or 16
+        int shift = pint->radix == 16 ? 4 : 3;
+        d = hex + (pint->flags & FLAG_CAP ? 16 : 0);
+        do {
+            tmp[ret++] = d[num & (pint->radix - 1)];
+            num >>= shift;
+        } while(num);
+        return ret;
     }
+    while(num >= 100) {
+        uint32_t q = ((uint64_t)num * 0x51eb851fU) >> 37; // num / 100 by reciprocal, exact for all 32 bit num
+        d = dec2 + 2 * (num - q * 100);
+        tmp[ret++] = d[1];
+        tmp[ret++] = d[0];
+        num = q;
+    }
+    d = dec2 + 2 * num;
+    tmp[ret++] = d[1];
+    if(num >= 10) tmp[ret++] = d[0];
     return ret;
 }
+#endif
+
+// output n digits from tmp (least significant first), with a decimal point before the last decs digits
+static int _pdigits(pint_t * pint, char * tmp, int n, int decs) {
+    int ret = n;
+    while(n-- > 0) {
+        _putc(pint, tmp[n]);
+        if(n == decs && decs > 0) {
+            _putc(pint, '.');
+            ret++;
+        }
+    }
+    return ret;
+}
+
+// high 64 bits of a 64x64 bit multiply, from 32 bit multiplies
+static uint64_t _umulh64(uint64_t a, uint64_t b) {
+    uint64_t al = (uint32_t)a;
+    uint64_t ah = a >> 32;
+    uint64_t bl = (uint32_t)b;
+    uint64_t bh = b >> 32;
+    uint64_t m1 = ah * bl + ((al * bl) >> 32);
+    uint64_t m2 = al * bh + (uint32_t)m1;
+    return ah * bh + (m1 >> 32) + (m2 >> 32);
+}
+
+// 64 bit version of _utoa - at worst 64 bit octal will be 22 digits
+static int _utoa64(pint_t * pint, uint64_t num, char * tmp) {
+    int n = 0;
+    if(pint->radix != 10) {
+        // 8 or 16 - shift and mask
+        int shift = pint->radix == 16 ? 4 : 3;
+        char hofs = pint->flags & FLAG_CAP ? 'A' - ':' : 'a' - ':';
+        do {
+            char c = (num & (pint->radix - 1)) + '0';
+            if(c > '9') c += hofs;
+            tmp[n++] = c;
+            num >>= shift;
+        } while(num);
+        return n;
+    }
+    // split off 9 decimal digits at a time until the rest fits in 32 bits
+    // num / 10^9 is (num / 2^9) / 1953125, by reciprocal multiply - exact for all 64 bit num
+    while(num >> 32) {
+        uint64_t q = _umulh64(num >> 9, 0x44b82fa09b5a53ULL) >> 11;
+        int k = _utoa(pint, (uint32_t)(num - q * 1000000000U), tmp + n);
+        n += k;
+        while(k++ < 9) tmp[n++] = '0';
+        num = q;
+    }
+    return n + _utoa(pint, (uint32_t)num, tmp + n);
+}
+
+// round a 64x64 bit multiply to the high 64 bits
+static uint64_t _umulr64(uint64_t a, uint64_t b) {
+    uint64_t al = (uint32_t)a;
+    uint64_t ah = a >> 32;
+    uint64_t bl = (uint32_t)b;
+    uint64_t bh = b >> 32;
+    uint64_t m = ((al * bl) >> 32) + (uint32_t)(ah * bl) + (uint32_t)(al * bh) + (1U << 31);
+    return ah * bh + ((ah * bl) >> 32) + ((al * bh) >> 32) + (m >> 32);
+}
+
+// num / 10 by reciprocal, exact for all 64 bit num
+static uint64_t _div10(uint64_t num) {
+    return _umulh64(num, 0xcccccccccccccccdULL) >> 3;
+}
+
+// number of digits _utoa64 would produce - for measuring, without converting
+static int _ndigits(pint_t * pint, uint64_t num) {
+    int n = 1;
+    if(pint->radix != 10) {
+        int shift = pint->radix == 16 ? 4 : 3;
+        while(num >>= shift) n++;
+        return n;
+    }
+    for(uint64_t p = 10; n < 20 && num >= p; p *= 10) n++;
+    return n;
+}
+
+// print an integer.  if dummy is true then only count the number of characters which would be output
+// plus the one potential decimal (which can't happen with octal but is a potential input, so cater for it...)
+// DECS MUST NEVER BE BIGGER THAN 20
+static int _puint(pint_t * pint, uint64_t num, int decs, int dummy) {
+    char tmp[22];
+    int n = _utoa64(pint, num, tmp);
+    TESTFN(if(decs > 20) *(int*)0=0;)
+    while(n <= decs) tmp[n++] = '0'; // if we have a decimal, we must output at least one digit before it
+    if(dummy) return decs > 0 ? n + 1 : n;
+    return _pdigits(pint, tmp, n, decs);
+}
+
+// cached powers of ten - 10^-348, 10^-340 ... 10^340 as normalised 64 bit significand and binary exponent
+static const struct {
+    uint64_t f;
+    int16_t e;
+} _pow10[] = {
+    {0xfa8fd5a0081c0288ULL, -1220}, {0xbaaee17fa23ebf76ULL, -1193}, {0x8b16fb203055ac76ULL, -1166},
+    {0xcf42894a5dce35eaULL, -1140}, {0x9a6bb0aa55653b2dULL, -1113}, {0xe61acf033d1a45dfULL, -1087},
+    {0xab70fe17c79ac6caULL, -1060}, {0xff77b1fcbebcdc4fULL, -1034}, {0xbe5691ef416bd60cULL, -1007},
+    {0x8dd01fad907ffc3cULL, -980}, {0xd3515c2831559a83ULL, -954}, {0x9d71ac8fada6c9b5ULL, -927},
+    {0xea9c227723ee8bcbULL, -901}, {0xaecc49914078536dULL, -874}, {0x823c12795db6ce57ULL, -847},
+    {0xc21094364dfb5637ULL, -821}, {0x9096ea6f3848984fULL, -794}, {0xd77485cb25823ac7ULL, -768},
+    {0xa086cfcd97bf97f4ULL, -741}, {0xef340a98172aace5ULL, -715}, {0xb23867fb2a35b28eULL, -688},
+    {0x84c8d4dfd2c63f3bULL, -661}, {0xc5dd44271ad3cdbaULL, -635}, {0x936b9fcebb25c996ULL, -608},
+    {0xdbac6c247d62a584ULL, -582}, {0xa3ab66580d5fdaf6ULL, -555}, {0xf3e2f893dec3f126ULL, -529},
+    {0xb5b5ada8aaff80b8ULL, -502}, {0x87625f056c7c4a8bULL, -475}, {0xc9bcff6034c13053ULL, -449},
+    {0x964e858c91ba2655ULL, -422}, {0xdff9772470297ebdULL, -396}, {0xa6dfbd9fb8e5b88fULL, -369},
+    {0xf8a95fcf88747d94ULL, -343}, {0xb94470938fa89bcfULL, -316}, {0x8a08f0f8bf0f156bULL, -289},
+    {0xcdb02555653131b6ULL, -263}, {0x993fe2c6d07b7facULL, -236}, {0xe45c10c42a2b3b06ULL, -210},
+    {0xaa242499697392d3ULL, -183}, {0xfd87b5f28300ca0eULL, -157}, {0xbce5086492111aebULL, -130},
+    {0x8cbccc096f5088ccULL, -103}, {0xd1b71758e219652cULL, -77}, {0x9c40000000000000ULL, -50},
+    {0xe8d4a51000000000ULL, -24}, {0xad78ebc5ac620000ULL, 3}, {0x813f3978f8940984ULL, 30},
+    {0xc097ce7bc90715b3ULL, 56}, {0x8f7e32ce7bea5c70ULL, 83}, {0xd5d238a4abe98068ULL, 109},
+    {0x9f4f2726179a2245ULL, 136}, {0xed63a231d4c4fb27ULL, 162}, {0xb0de65388cc8ada8ULL, 189},
+    {0x83c7088e1aab65dbULL, 216}, {0xc45d1df942711d9aULL, 242}, {0x924d692ca61be758ULL, 269},
+    {0xda01ee641a708deaULL, 295}, {0xa26da3999aef774aULL, 322}, {0xf209787bb47d6b85ULL, 348},
+    {0xb454e4a179dd1877ULL, 375}, {0x865b86925b9bc5c2ULL, 402}, {0xc83553c5c8965d3dULL, 428},
+    {0x952ab45cfa97a0b3ULL, 455}, {0xde469fbd99a05fe3ULL, 481}, {0xa59bc234db398c25ULL, 508},
+    {0xf6c69a72a3989f5cULL, 534}, {0xb7dcbf5354e9beceULL, 561}, {0x88fcf317f22241e2ULL, 588},
+    {0xcc20ce9bd35c78a5ULL, 614}, {0x98165af37b2153dfULL, 641}, {0xe2a0b5dc971f303aULL, 667},
+    {0xa8d9d1535ce3b396ULL, 694}, {0xfb9b7cd9a4a7443cULL, 720}, {0xbb764c4ca7a44410ULL, 747},
+    {0x8bab8eefb6409c1aULL, 774}, {0xd01fef10a657842cULL, 800}, {0x9b10a4e5e9913129ULL, 827},
+    {0xe7109bfba19c0c9dULL, 853}, {0xac2820d9623bf429ULL, 880}, {0x80444b5e7aa7cf85ULL, 907},
+    {0xbf21e44003acdd2dULL, 933}, {0x8e679c2f5e44ff8fULL, 960}, {0xd433179d9c8cb841ULL, 986},
+    {0x9e19db92b4e31ba9ULL, 1013}, {0xeb96bf6ebadf77d9ULL, 1039}, {0xaf87023b9bf0ee6bULL, 1066},
+};
+
+static const uint32_t _pow10_32[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+// pick the cached power which scales a normalised f * 2^e so that the product has 4..32 integer bits
+// returns the table index - the product is f * 10^(8 * index - 348), so the decimal exponent is 348 - 8 * index
+static int _pow10_find(int e) {
+    int i = (1124 - e) * 2 / 53; // 26.5 binary orders per step
+    while(_pow10[i].e > -96 - e) i--;
+    while(_pow10[i].e < -124 - e) i++;
+    return i;
+}
+
+// fixed conversion: f * 2^e to a num of maxdig significant digits (rounded) * 10^exp
+// one cached power multiply, then digits are peeled from the integer and fraction parts
+static int _dgen(uint64_t * pnum, int * pexp, uint64_t f, int e, int maxdig) {
+    int n = __builtin_clzll(f);
+    f <<= n;
+    e -= n;
+    int i = _pow10_find(e);
+    uint64_t w = _umulr64(f, _pow10[i].f);
+    int s = -(e + _pow10[i].e + 64); // 32..60 fraction bits
+    uint64_t mask = ((uint64_t)1 << s) - 1;
+    uint64_t num = w >> s;
+    int exp = 348 - 8 * i;
+    int sigc = 1;
+    while(sigc < 10 && num >= _pow10_32[sigc]) sigc++;
+    // fill up to 19 digits (10^19 still fits)
+    for(w &= mask; sigc < 19; sigc++, exp--) {
+        w *= 10;
+        num = num * 10 + (w >> s);
+        w &= mask;
+    }
+    // round to maxdig, which absorbs the multiply error and recovers exact decimals
+    while(sigc > maxdig + 1) {
+        num = _div10(num);
+        sigc--;
+        exp++;
+    }
+    num = _div10(num + 5);
+    sigc--;
+    exp++;
+    if(num == (uint64_t)_pow10_32[9] * _pow10_32[maxdig - 9]) {
+        num = _div10(num);
+        exp++;
+    }
+    *pnum = num;
+    *pexp = exp;
+    return sigc;
+}
+
+// the reverse of _dgen, for strtof/scanf: m * 10^e10 (-348 <= e10 < 348) as a normalised significand, returns the
+// binary exponent (value = *pf * 2^ret) - one cached power multiply, then exact small powers.  Up to 10^27
+// only exact powers are used, so exact halfway cases round correctly
+int _dscale(uint64_t * pf, uint64_t m, int e10) {
+    int n = __builtin_clzll(m);
+    uint64_t f = m << n;
+    int e = -n;
+    if(e10 < 0 || e10 > 27) {
+        int i = (e10 + 348) / 8;
+        f = _umulr64(f, _pow10[i].f);
+        e += _pow10[i].e + 64;
+        e10 -= 8 * i - 348;
+    }
+    while(e10 > 0) {
+        int r = e10 > 9 ? 9 : e10;
+        uint64_t p = _pow10_32[r];
+        n = __builtin_clzll(f);
+        f <<= n;
+        e -= n;
+        n = __builtin_clzll(p);
+        f = _umulr64(f, p << n);
+        e += 64 - n;
+        e10 -= r;
+    }
+    n = __builtin_clzll(f);
+    *pf = f << n;
+    return e - n;
+}
+
+// shortest conversion (grisu2): the fewest digits which still lie between the midpoints to the neighbouring
+// floats, so they read back as the same value.  f * 2^e, lowgap is set when the float below is closer
+static int _dshort(uint64_t * pnum, int * pexp, uint64_t f, int e, int lowgap) {
+    // boundaries, scaled to a common exponent
+    uint64_t mp = (f << 1) + 1;
+    uint64_t mm = lowgap ? (f << 2) - 1 : (f << 1) - 1;
+    int n = __builtin_clzll(mp);
+    mp <<= n;
+    mm <<= lowgap ? n - 1 : n;
+    f <<= n + 1;
+    e -= n + 1;
+    int i = _pow10_find(e);
+    uint64_t w = _umulr64(f, _pow10[i].f);
+    uint64_t wp = _umulr64(mp, _pow10[i].f) - 1;
+    uint64_t delta = wp - (_umulr64(mm, _pow10[i].f) + 1);
+    uint64_t wp_w = wp - w;
+    int s = -(e + _pow10[i].e + 64);
+    uint64_t one = (uint64_t)1 << s;
+    uint32_t p1 = wp >> s;
+    uint64_t p2 = wp & (one - 1);
+    uint64_t num = 0;
+    uint64_t rest;
+    uint64_t unit;
+    int sigc = 0;
+    int kappa = 1;
+    while(kappa < 10 && p1 >= _pow10_32[kappa]) kappa++;
+    *pexp = 348 - 8 * i;
+    // integer digits
+    while(kappa > 0) {
+        uint32_t d = p1 / _pow10_32[--kappa];
+        p1 -= d * _pow10_32[kappa];
+        if(d || sigc) {
+            num = num * 10 + d;
+            sigc++;
+        }
+        rest = ((uint64_t)p1 << s) + p2;
+        if(rest <= delta) {
+            unit = (uint64_t)_pow10_32[kappa] << s;
+            goto done;
+        }
+    }
+    // fraction digits
+    for(;;) {
+        p2 *= 10;
+        delta *= 10;
+        wp_w *= 10;
+        if((p2 >> s) || sigc) {
+            num = num * 10 + (p2 >> s);
+            sigc++;
+        }
+        p2 &= one - 1;
+        kappa--;
+        if(p2 < delta) {
+            rest = p2;
+            unit = one;
+            break;
+        }
+    }
+done:
+    // step the last digit down towards the real value, while we stay inside the boundaries
+    while(rest < wp_w && delta - rest >= unit && (rest + unit < wp_w || wp_w - rest > rest + unit - wp_w)) {
+        num--;
+        rest += unit;
+    }
+    *pnum = num;
+    *pexp += kappa;
+    return sigc;
+}
 
 // build with constant radix if we are not building 'a' support...
 #ifdef BUILD_A
@@ -207,23 +789,24 @@ static int _puint(pint_t * pint, uint32_t num, int decs, int dummy) {
 
 // previous implememntation used floating point manipulation to get the numbers in the right
 // significant range for rendering
-// changing this to do a direct transform from fp format by incrementally moving e2 bits to number
-// and back to e10...
+// then a direct transform which moved e2 bits to e10 one at a time (up to ~150 loops)
+// now one multiply by a cached power of ten gets the decimal digits in one step, for real doubles
 // make weak so we can remove this if we don't want floats...
-int __attribute__((weak)) _printf(pint_t * pint, float fnum, char fmt) {
-    uint32_t num;
+int __attribute__((weak)) _printf(pint_t * pint, double fnum, char fmt) {
+    uint64_t num;
     int exp = 0;
     int sigc;
     int pad;
     int ret;
     char padc = 0;
     int zeros;
-    const float limf = 4000000000.0f;
-    //const float limf = 4000.0f;
     
     // strip least significant digit while preserving absolute value
     void chompnum(void) {
-        num /= FRADIX;
+#ifdef BUILD_A
+        if(FRADIX == 16) num >>= 4; else
+#endif
+        num = _div10(num);
         sigc--;
         exp++;
     }
@@ -276,26 +859,38 @@ done:
 
     // convert float to sig + exp10
     for(;;) {	// fake for loop, so we can break out when we get a number...
-        union { float f; uint32_t u; } unum = { .f = fnum }; // need bitwise access to float
+        uint64_t bits;
+        int mbits = 52; // significand bits
+        int emax = 0x7ff; // exponent all ones
         int e2;
+        // need bitwise access to float - narrow first for %hg, or if double is really float (AVR)
+        if(sizeof(fnum) == 4 || pint->flags & FLAG_SINGLE) {
+            union { float f; uint32_t u; } unum = { .f = fnum };
+            bits = unum.u;
+            mbits = 23;
+            emax = 0xff;
+        } else {
+            union { double f; uint64_t u; } unum = { .f = fnum };
+            bits = unum.u;
+        }
         // strip sign
-        if(unum.u & 0x80000000U) {
+        if(bits >> mbits > (uint64_t)emax) {
             padc = '-';
         } else {
             if(pint->flags & FLAG_SPACE) padc = ' ';
             if(pint->flags & FLAG_PLUS) padc = '+';
         }
-        // strip significand (lower 23 bits)
-        num = unum.u & 0x7fffff;
+        // strip significand
+        num = bits & (((uint64_t)1 << mbits) - 1);
         // strip exponent2
-        e2 = (unum.u >> 23) & 0xff;
+        e2 = (bits >> mbits) & emax;
         // special cases...
         // zero
         if(num == 0 && e2 == 0) {
             sigc = 1;
             break;
         }
-        if(e2 == 255) {
+        if(e2 == emax) {
             static char infstr[] = "inf";
             static char ninfstr[] = "-inf";
             static char nanstr[] = "nan";
@@ -312,7 +907,7 @@ done:
         }
         // normalised floats skip the leading '1'
         if(e2) { // e2 = 0, num non zero is denormalised!
-            num |= 0x800000;
+            num |= (uint64_t)1 << mbits;
         } else {
             e2++; // leading digit becomes significant
         }
@@ -320,65 +915,48 @@ done:
 #ifdef BUILD_A
         if(fmt == 'a') {
             // formatting not complete yet
-            num <<= 1; // normailse (the 1 bit we added is the only one before the decimal)
-            exp = e2 - (127 + 6);
-            sigc = 7;
+            sigc = mbits / 4 + 1 + (mbits % 4 != 0);
+            num <<= (sigc - 1) * 4 - mbits; // normalise (the 1 bit we added is the only one before the decimal)
+            exp = e2 - (emax >> 1) - (sigc - 1);
             break;
         }
 #endif
-        // remove exponent bias (we treat the whole 24 bits as significant, so we need to multiply by 2^-23 to get the real value)
-        e2 -= 127 + 23;
-        //TESTFN(fprintf(stderr, "'%.20g' %d %d '%.20g'\n", fnum, num, e2, (double)num*pow(2.0,(double)e2));)
-        // move e2 to exp by progressively multiplying/dividing by 2/10 to keep total number constant
-        // n = sig * 2^e2 * 10^exp ... start with exp=0 (10^0 = 1) and move to e2=0 (2^0 = 0) so we can eliminate the e2 term
-        // plenty of optimisations to do, eg:
-        // use seperate 32 bit multiplier, rather than multiplying in place (and final 64 bit calc)
-        // start with biggest offset
-        // consume 3 bits at a time
-        // but goal is smallest code/ram space, so use non-optimal route...
-        // do least likely case first, as last case can be a little more optimised
-        while(e2 > 0) { // every time we reduce e2 by 1, we must multiply num by 2 to compensate
-            e2--;
-            if(num & 0x80000000U) {
-                num /= 10;
-                exp++;
-            }
-            num <<= 1;
-        }
-        // may not have enough significant digits yet...
-        // split up this loop so normalisation always runs
-        // every time we increase e2 by 1, we must divide num by 2 to compensate
-        for(;;) { 
-            while(!(num & 0xf0000000U)) { //sub normal numbers need to be shifted up...
-                num *= 10;
-                exp--;
-            }
-            if(e2++ >= 0) break;
-            num >>= 1;
-        }
-        //TESTFN(fprintf(stderr, "'%.20g' %d %d '%.20g'\n", fnum, num, exp, (double)num*pow(10.0,(double)exp));)
-        // num is increased until one of 31,30,29,28 are set
-        // then shifed right by one
-        // so one of 31,30,29,28,27 is the top bit
-        // result is either 9 or 10 significant digits
-        if(num >= 1000000000U) {
-            sigc = 10;
+        // remove exponent bias (we treat the whole significand as an integer, so we need to multiply by 2^-mbits to get the real value)
+        e2 -= (emax >> 1) + mbits;
+        if(pint->flags & FLAG_SHORT) {
+            sigc = _dshort(&num, &exp, num, e2, num == (uint64_t)1 << mbits && (bits >> mbits & emax) > 1);
         } else {
-            sigc = 9;
+            // 17 digits always round trip a double, 9 a float
+            sigc = _dgen(&num, &exp, num, e2, mbits == 23 ? 9 : 18);
         }
         break;
     }
-    //TESTFN(fprintf(stderr, "%f %u %d %d\n", fnum, num, exp, sigc);)
+    //TESTFN(fprintf(stderr, "%f %llu %d %d\n", fnum, num, exp, sigc);)
 
     // seems to be a common definition for all sub formats
     if(pint->prec == 255) pint->prec = 6;
     
+    // shortest round trip - precision follows the digits we have
+    if(pint->flags & FLAG_SHORT && fmt != 'a') {
+        if(fmt == 'g') {
+            // as 'g', with the precision raised to cover all the digits
+            if(pint->prec < sigc) pint->prec = sigc;
+            pad = exp + (sigc - 1);
+            fmt = pad < -4 || pad >= pint->prec ? 'e' : 'f';
+        }
+        if(fmt == 'e') {
+            pint->prec = sigc - 1;
+        } else {
+            pint->prec = exp < 0 ? -exp : 0;
+        }
+    }
+    
     // pre-process 'g' and morph to 'e'/'f' as required
     if(fmt == 'g') {
         //if(!(pint->flags & FLAG_ALT)) pint->flags |= FLAG_STRIP0; // strip trailing zeros for 'g' and not alt format
         if(pint->prec == 0) pint->prec++; // ...  if the precision is zero,  it  is  treated  as  1
         roundnum(pint->prec, 1); // ...The precision specifies the number of significant digits we desire in the output
-        while(num && num%FRADIX == 0) chompnum(); // chomp trailing zeros, will use precision specifier to add them back, if required
+        while(num && _div10(num) * 10 == num) chompnum(); // chomp trailing zeros, will use precision specifier to add them back, if required
         pad = exp + (sigc - 1); // tmp calculate exponent
         if(pad < -4 || pad >= pint->prec) { // from man page, exponent < -4 or >= precision, render as e otherwise f
             if(pint->flags & FLAG_ALT) {
@@ -405,7 +983,7 @@ done:
         //fprintf(stderr, "%f %u %d %d\n", fnum, num, exp, sigc);
         // how many significant bits before the decimal?
         pad = sigc + exp;
-        if(pad < 0) pad = 1; // always print at least 1 0 before the decimal
+        if(pad <= 0) pad = 1; // always print at least 1 0 before the decimal
         if(pint->prec > 0) {
             pad += pint->prec + 1;
         } else {
@@ -418,6 +996,7 @@ done:
         exp += sigc - 1; // final exponent
         // calculate final length
         pad = 5; // 1 digit + e+dd
+        if(exp >= 100 || exp <= -100) pad++; // doubles can reach e+ddd
         //fprintf(stderr, "%f %u %d %d\n", fnum, num, exp, sigc);
         //if(pint->flags & FLAG_STRIP0) {
         //    pad += sigc; // sigc = 1 + decimals, we already counted the 1 above, so this is decimal point + decimals
@@ -430,27 +1009,10 @@ done:
         }
     }
     if(padc) pad++;
+    if(_pfull(pint)) return pad < pint->width ? pint->width : pad;
     
-    // calculate total padding (and set ret to pre-calculated chars)
-    if(pint->width > 0 && pad < pint->width) {
-        pad = pint->width - pad;
-        ret = pint->width;
-    } else {
-        ret = pad;
-        pad = 0;
-    }
-    // output initial pad
-    if(!(pint->flags & FLAG_MINUS)) {
-        if(pint->flags & FLAG_0) {
-            if(padc) _putc(pint, padc);
-            padc = 0;
-            _padc(pint, '0', &pad);
-        } else {
-            _padc(pint, ' ', &pad);
-        }
-    }
-    // output first char
-    if(padc) _putc(pint, padc);
+    // output initial pad and first char (and set ret to pre-calculated chars)
+    ret = _pfield(pint, padc, pad, &pad);
     
     // now build the numeric portion based on format
     if(fmt == 'f') {
@@ -513,29 +1075,24 @@ done:
     return ret;
 }
 
-static int _printi(pint_t * pint, unsigned int num, char fmt) {
+// lay out an integer - tmp holds n digits (least significant first), sign is '-' for negative 'i' formats
+static int _pnum(pint_t * pint, char * tmp, int n, char fmt, char sign) {
     int pad;
     int ret = 0;
     int zeros = 0;
-    char padc[2] = {0};
-    
-    if(num == 0 && pint->prec == 0) return 0; // special case - no output (only for decimals - process floats above...
+    char padc[2] = {sign, 0};
     
     // decimal formats
     switch(fmt) {
         //case 'd': // translated to i before calling
         case 'i':
-            if((int)num < 0) {
-                num = -(int)num;
-                padc[0] = '-';
-            } else {
+            if(!sign) {
                 if(pint->flags & FLAG_SPACE) padc[0] = ' ';
                 if(pint->flags & FLAG_PLUS) padc[0] = '+';
             }
             break;
         
         case 'x':
-            pint->radix = 16;
             if(pint->flags & FLAG_ALT) {
                 padc[0] = '0';
                 padc[1] = pint->flags & FLAG_CAP ? 'X' : 'x';
@@ -543,11 +1100,10 @@ static int _printi(pint_t * pint, unsigned int num, char fmt) {
             break;
         
         case 'o':
-            pint->radix = 8;
             if(pint->flags & FLAG_ALT) padc[0] = '0'; // fixme - special case - suppress if 'zeros' is set
             break;
     }
-    pad = _puint(pint, num, 0, 1);
+    pad = n;
     if(pint->prec != 255 && pad < pint->prec) {
         zeros = pint->prec - pad;
         pad = pint->prec;
@@ -560,6 +1116,7 @@ static int _printi(pint_t * pint, unsigned int num, char fmt) {
     } else {
         pad = 0;
     }
+    if(_pfull(pint)) return n + zeros + pad + (padc[0] != 0) + (padc[1] != 0);
     if(!(pint->flags & FLAG_MINUS)) {
         if(pint->flags & FLAG_0 && pad > 0 && pint->prec == 255) {
             zeros += pad;
@@ -577,271 +1134,656 @@ static int _printi(pint_t * pint, unsigned int num, char fmt) {
         ret++;
     }
     ret += _padc(pint, '0', &zeros);
-    ret += _puint(pint, num, 0, 0);
+    ret += _pdigits(pint, tmp, n, 0);
     ret += _padc(pint, ' ', &pad);
     return ret;
 }
 
-// the real deal - this parses the format string and dishes out the individual formats
-int _vprintf(pint_t * pint, const char *format, va_list ap) {
-    int ret = 0;
-    int mode = 0;
-    char mod;
-    char c;
+int _printi(pint_t * pint, unsigned int num, char fmt) {
+    char tmp[12];
+    char sign = 0;
     
-    // going to do a direct phase for phase parser, each self contained...
-    while((c = *(format++))) { // always consume the current character!
-        //TESTFN(fprintf(stderr,"%d '%c'\n", mode, c);)
-        
-        // mode 0 - just spitting out characters...
-        if(mode == 0) {
-            if(c == '%') {
-                mode = 1;
-                pint->radix = 10; // default to 10
-                pint->flags = 0;
-                pint->width = 0;
-                pint->prec = 255;
-                mod = 0;
-                continue;
-            }
-            // output current character
-            _putc(pint, c);
-            ret++;
-            continue;
+    if(num == 0 && pint->prec == 0) return 0; // special case - no output (only for decimals - process floats above...
+    if(fmt == 'i' && (int)num < 0) {
+        num = -(int)num;
+        sign = '-';
+    }
+    if(fmt == 'x') pint->radix = 16;
+    if(fmt == 'o') pint->radix = 8;
+    // convert once - digit count is needed for padding (and is all we need when measuring)
+    return _pnum(pint, tmp, _pfull(pint) ? _ndigits(pint, num) : _utoa(pint, num, tmp), fmt, sign);
+}
+
+// 64 bit integers - make weak so we can truncate to 32 bits instead if we don't want them...
+int __attribute__((weak)) _printll(pint_t * pint, uint64_t num, char fmt) {
+    char tmp[22];
+    char sign = 0;
+    
+    if(num == 0 && pint->prec == 0) return 0;
+    if(fmt == 'i' && (int64_t)num < 0) {
+        num = -(int64_t)num;
+        sign = '-';
+    }
+    if(fmt == 'x') pint->radix = 16;
+    if(fmt == 'o') pint->radix = 8;
+    return _pnum(pint, tmp, _pfull(pint) ? _ndigits(pint, num) : _utoa64(pint, num, tmp), fmt, sign);
+}
+
+// fixed point - num carries bits fraction bits, or -bits decimal places when bits is negative
+// integer arithmetic only, and truncated like the default float rounding
+// make weak so we can remove this if we don't want fixed point...
+int __attribute__((weak)) _printk(pint_t * pint, uint64_t num, int bits, char fmt __attribute__((unused))) {
+    char tmp[22];
+    char padc = 0;
+    int n;
+    int dec = 0; // fraction digits at the bottom of tmp
+    int lead = 0; // fraction zeros above them (scales past the 20 digits of a uint64)
+    int pad;
+    int ret;
+    int zeros;
+    uint64_t mask = 0;
+    
+    // K is unsigned
+    if(!(pint->flags & FLAG_CAP) && (int64_t)num < 0) {
+        num = -num;
+        padc = '-';
+    } else {
+        if(pint->flags & FLAG_SPACE) padc = ' ';
+        if(pint->flags & FLAG_PLUS) padc = '+';
+    }
+    if(bits < 0) {
+        // decimal scale - the bottom digits are the fraction
+        dec = bits < -254 ? 254 : -bits;
+        if(pint->prec == 255) pint->prec = dec;
+        if(dec > 21) {
+            lead = dec - 21;
+            dec = 21;
         }
-        
-        // mode 1 - flags
-        if(mode == 1) {
-            switch(c) {
-                case '#': pint->flags |= FLAG_ALT; continue;
-                case '0': pint->flags |= FLAG_0; continue;
-                case '-': pint->flags |= FLAG_MINUS; continue;
-                case ' ': pint->flags |= FLAG_SPACE; continue;
-                case '+': pint->flags |= FLAG_PLUS; continue;
-                case '\'':
-                case 'I':
-                    // don't handle these - but dont break format parser...
-                    continue;
-            }
-            // not a flag
-            mode = 2;
-            // fall through and try width parser
+        n = _utoa64(pint, num, tmp);
+        while(n <= dec) tmp[n++] = '0';
+    } else {
+        // binary - split off the fraction, which is turned into digits as it is output
+        if(pint->prec == 255) pint->prec = 6;
+        if(bits > 60) {
+            // keep num * 10 in 64 bits - the dropped bits are below the digits a uint64 can show
+            num = bits - 60 < 64 ? num >> (bits - 60) : 0;
+            bits = 60;
         }
-        
-        // mode 2 - width (*)
-        if(mode == 2) {
-            if(c == '*') {
-                // read width from next parm
-                int i = va_arg(ap, int);
-                if(i < 0) {
-                    pint->flags |= FLAG_MINUS;
-                    pint->width = -i;
-                } else {
-                    pint->width = i;
-                }
-                mode = 4; // skip numeric width parser
-                continue;
-            }
-            // not a *
-            mode = 3;
-            // fall through to read numeric width
+        mask = ((uint64_t)1 << bits) - 1;
+        n = _utoa64(pint, num >> bits, tmp);
+    }
+    pad = n - dec;
+    if(pint->prec > 0) {
+        pad += pint->prec + 1;
+    } else {
+        if(pint->flags & FLAG_ALT) pad++;
+    }
+    if(padc) pad++;
+    if(_pfull(pint)) return pad < pint->width ? pint->width : pad;
+    ret = _pfield(pint, padc, pad, &pad);
+    _pdigits(pint, tmp + dec, n - dec, 0);
+    if(pint->prec > 0 || pint->flags & FLAG_ALT) _putc(pint, '.');
+    zeros = pint->prec;
+    if(bits < 0) {
+        while(zeros > 0 && lead > 0) {
+            _putc(pint, '0');
+            zeros--;
+            lead--;
         }
-        
-        // mode 3 - numeric width
-        if(mode == 3) {
-            if(c == '$') {
-                // m$ format - treat as not set...
-                pint->width = 0;
-            } else if(isdigit(c)) {
-                pint->width *= 10;
-                pint->width += c - '0';
-                continue;
-            }
-            mode = 4;
-            // fall through and look for precision separator
+        while(zeros > 0 && dec > 0) {
+            _putc(pint, tmp[--dec]);
+            zeros--;
         }
-        
-        // mode 4 - precision separator
-        if(mode == 4) {
-            if(c == '.') {
-                mode = 5; // * precision
-                continue;
+    } else {
+        // 2^-bits has exactly bits decimals, so the rest are zeros
+        num &= mask;
+        while(zeros > 0 && num) {
+            num *= 10;
+            _putc(pint, '0' + (num >> bits));
+            num &= mask;
+            zeros--;
+        }
+    }
+    _padc(pint, '0', &zeros);
+    _padc(pint, ' ', &pad);
+    return ret;
+}
+
+// byte to two hex digits - one lookup per byte
+static const char _hexpair[512] =
+    "000102030405060708090a0b0c0d0e0f"
+    "101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f"
+    "303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f"
+    "505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f"
+    "707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f"
+    "909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+    "b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+    "d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+    "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+// hex of n bytes into tmp, sep between bytes if not 0 - returns the length
+static int _hexbytes(char * tmp, const uint8_t * b, int n, char sep, int cap) {
+    char * t = tmp;
+    while(n-- > 0) {
+        const char * h = _hexpair + 2 * *b++;
+        t[0] = h[0];
+        t[1] = h[1];
+        if(cap) {
+            if(t[0] > '9') t[0] -= 'a' - 'A';
+            if(t[1] > '9') t[1] -= 'a' - 'A';
+        }
+        t += 2;
+        if(sep && n) *t++ = sep;
+    }
+    return t - tmp;
+}
+
+// %H - len bytes at buf as hex, one field (space flag separates the bytes, # prefixes 0x)
+// make weak so we can remove this if we don't want it...
+int __attribute__((weak)) _printh(pint_t * pint, const uint8_t * buf, int len) {
+    char tmp[16 * 3];
+    char sep = pint->flags & FLAG_SPACE ? ' ' : 0;
+    int pad;
+    int ret;
+    if(!buf || len < 0) len = 0;
+    ret = len * 2 + (sep && len ? len - 1 : 0) + (pint->flags & FLAG_ALT ? 2 : 0);
+    ret = _pfield(pint, 0, ret, &pad);
+    if(_pfull(pint)) return ret;
+    if(pint->flags & FLAG_ALT) _putn(pint, pint->flags & FLAG_CAP ? "0X" : "0x", 2);
+    while(len > 0) {
+        int k = len > 16 ? 16 : len;
+        len -= k;
+        int n = _hexbytes(tmp, buf, k, sep, pint->flags & FLAG_CAP);
+        if(sep && len) tmp[n++] = sep;
+        _putn(pint, tmp, n);
+        buf += k;
+    }
+    _padc(pint, ' ', &pad);
+    return ret;
+}
+
+// hex dump, 16 bytes per line - each line is built on the stack and output in one go
+int _phexdump(pint_t * pint, const uint8_t * buf, int len, int flags) {
+    char line[8 + 2 + 16 * 3 + 1 + 18 + 1];
+    int ret = 0;
+    int ofs;
+    int digs = len > 0x10000 ? 8 : 4;
+    for(ofs = 0; ofs < len; ofs += 16) {
+        int k = len - ofs > 16 ? 16 : len - ofs;
+        int n = 0;
+        int i;
+        if(flags & HEXDUMP_OFFSET) {
+            uint32_t o = ofs;
+            for(i = digs - 1; i >= 0; i--, o >>= 4) line[i] = "0123456789abcdef"[o & 15];
+            line[digs] = ':';
+            line[digs + 1] = ' ';
+            n = digs + 2;
+        }
+        n += _hexbytes(line + n, buf + ofs, k, ' ', flags & HEXDUMP_UPPER);
+        if(flags & HEXDUMP_ASCII) {
+            // pad a short last line, so the column lines up
+            for(i = n + (16 - k) * 3 + 2; n < i; n++) line[n] = ' ';
+            line[n++] = '|';
+            for(i = 0; i < k; i++) {
+                uint8_t c = buf[ofs + i];
+                line[n++] = c >= ' ' && c < 0x7f ? c : '.';
             }
-            mode = 7; // modifiers
+            line[n++] = '|';
         }
+        line[n++] = '\n';
+        ret += _putn(pint, line, n);
+    }
+    return ret;
+}
+
+#if LIBC_PRINTF_CONVS > 0
+#if LIBC_PRINTF_CACHE > 0
+static void _pcache_rebuild(void);
+#else
+#define _pcache_rebuild()
+#endif
+
+// user conversions (printf_register)
+static struct {
+    char c;
+    printf_conv_fn fn;
+} _printf_convs[LIBC_PRINTF_CONVS];
+static uint8_t _printf_nconv = 0;
 
-        // mode 5 - precision (*)
-        if(mode == 5) {
-            if(c == '*') {
-                // read precision from next parm
-                int i = va_arg(ap, int);
-                pint->prec = i < 0 ? 255 : i;
-                mode = 7; // skip numeric precision parser
+static printf_conv_fn _pconv(char c) {
+    int i;
+    for(i = 0; i < _printf_nconv; i++) {
+        if(_printf_convs[i].c == c) return _printf_convs[i].fn;
+    }
+    return NULL;
+}
+
+// add (or replace, or with fn NULL disable) conversion c - returns 0 if the table is full
+int FNPRE(printf_register)(char c, printf_conv_fn fn) {
+    int i;
+    for(i = 0; i < _printf_nconv && _printf_convs[i].c != c; i++);
+    if(i == LIBC_PRINTF_CONVS) return 0;
+    _printf_convs[i].fn = fn;
+    _printf_convs[i].c = c;
+    if(i == _printf_nconv) _printf_nconv++;
+    _pcache_rebuild(); // a registered 'I' is no longer a flag
+    return 1;
+}
+#else
+#define _pconv(c) ((printf_conv_fn)NULL)
+#endif
+
+/* next '%' or the terminator - literal runs are scanned 16 bytes at a time with SSE2 on hosts, else a word at a
+   time (zero byte test on the word and on the word xor '%'). Loads are aligned, so they never cross into the
+   next page even when they read past the terminator */
+static const char * _pscan(const char * s) {
+#ifndef SMALL_PSCAN
+#ifdef __SSE2__
+    for(; (uintptr_t)s & 15; s++) {
+        if(!*s || *s == '%') return s;
+    }
+    const __m128i pct = _mm_set1_epi8('%');
+    const __m128i zero = _mm_setzero_si128();
+    for(;; s += 16) {
+        __m128i v = _mm_load_si128((const __m128i *)s);
+        unsigned m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(v, pct)));
+        if(m) return s + __builtin_ctz(m);
+    }
+#else
+    typedef uint32_t __attribute__((may_alias)) pword_t;
+    for(; (uintptr_t)s & 3; s++) {
+        if(!*s || *s == '%') return s;
+    }
+    for(;; s += 4) {
+        uint32_t v = *(const pword_t *)s;
+        uint32_t p = v ^ 0x25252525U;
+        if((((v - 0x01010101U) & ~v) | ((p - 0x01010101U) & ~p)) & 0x80808080U) break;
+    }
+#endif
+#endif
+    while(*s && *s != '%') s++;
+    return s;
+}
+
+/* one conversion spec - the literal run before it is format[0..lit), the spec (from the %) the next len bytes */
+typedef struct {
+    uint16_t lit;
+    uint8_t len; // 0 - the format ends after the literal
+    uint8_t flags;
+    uint8_t width;
+    uint8_t prec;
+    uint8_t star; // PSTAR_* - width/precision come from the arguments
+    char mod;
+    char conv;
+} __attribute__((packed)) pdesc_t;
+
+#define PSTAR_WIDTH 1
+#define PSTAR_PREC 2
+
+/* parse the flags, width, precision and modifier of a spec (format points after the %) - returns the format
+   after the conversion character, or NULL if the format ends first. Digits accumulate in 8 bits and an m$
+   index reads as unset, as they always have */
+static const char * _pspec(const char * format, pdesc_t * d) {
+    char c;
+    d->flags = 0;
+    d->width = 0;
+    d->prec = 255;
+    d->star = 0;
+    d->mod = 0;
+    // flags
+    for(;; format++) {
+        switch(*format) {
+            case '#': d->flags |= FLAG_ALT; continue;
+            case '0': d->flags |= FLAG_0; continue;
+            case '-': d->flags |= FLAG_MINUS; continue;
+            case ' ': d->flags |= FLAG_SPACE; continue;
+            case '+': d->flags |= FLAG_PLUS; continue;
+            case '\'': d->flags |= FLAG_SHORT; continue;
+            case 'I':
+                if(_pconv('I')) break; // user conversion
+                // don't handle these - but dont break format parser...
                 continue;
-            }
-            // not a *
-            mode = 6;
+        }
+        break;
+    }
+    // width
+    if(*format == '*') {
+        d->star |= PSTAR_WIDTH;
+        format++;
+    } else {
+        while(isdigit(c = *format)) {
+            d->width = d->width * 10 + c - '0';
+            format++;
+        }
+        if(c == '$') d->width = 0; // m$ format - treat as not set (and print the $)
+    }
+    // precision
+    if(*format == '.') {
+        format++;
+        if(*format == '*') {
+            d->star |= PSTAR_PREC;
+            format++;
+        } else {
             // very special case, any negative precision means no precision
-            if(c == '-') {
-                pint->prec = 255; // will always stay negative in numeric parser
-                continue; // consume - sign
+            if(*format == '-') format++;
+            else d->prec = 0;
+            while(isdigit(c = *format)) {
+                d->prec = d->prec * 10 + c - '0';
+                format++;
             }
-            pint->prec = 0;
-            // fall through to read numeric width
+            if(c == '$') d->prec = 255;
         }
-        
-        // mode 6 - numeric precision
-        if(mode == 6) {
-            if(c == '$') {
-                // m$ format - treat as not set...
-                pint->prec = 255;
-            } else if(isdigit(c)) {
-                pint->prec *= 10;
-                pint->prec += c - '0';
-                continue;
+    }
+    // modifier
+    switch(c = *format) {
+        case 'h':
+        case 'l':
+            if(format[1] == c) {
+                // hh / ll
+                c = c == 'h' ? 'H' : 'q';
+                format++;
             }
-            mode = 7;
-            // fall through and look for modifier
+        case 'q':
+        case 'L':
+        case 'j':
+        //case 'z': // promote to int, so ignore
+        //case 't':
+            d->mod = c;
+            format++;
+            break;
+        case 'Z':
+            d->mod = 'z';
+            format++;
+            break;
+    }
+    if(!(d->conv = *format)) return NULL;
+    return format + 1;
+}
+
+#if LIBC_PRINTF_CACHE > 0
+/* formats parsed in advance (printf_precompile) - _vprintf replays the specs and copies the literal runs from
+   the format without looking at them again. Entries are keyed by the format address only */
+static struct {
+    const char * fmt;
+    uint8_t pinned;
+    pdesc_t d[LIBC_PRINTF_CACHE_SPECS + 1]; // and the trailing run
+} _pcache[LIBC_PRINTF_CACHE];
+static uint32_t _pcache_hits = 0;
+static uint32_t _pcache_misses = 0;
+#ifdef LIBC_PRINTF_CACHE_AUTO
+static uint8_t _pcache_next = 0;
+#endif
+
+// parse format into d - returns 0 if it has too many specs (or too long a run) to keep
+static int _pcompile(const char * format, pdesc_t * d) {
+    const char * s;
+    int n;
+    for(n = 0; n <= LIBC_PRINTF_CACHE_SPECS; n++, d++) {
+        s = _pscan(format);
+        if(s - format > 0xffff) return 0;
+        d->lit = s - format;
+        d->len = 0;
+        if(!*s || !(format = _pspec(s + 1, d))) return 1;
+        if(format - s > 255) return 0;
+        d->len = format - s;
+    }
+    return 0;
+}
+
+// cached specs of format, or NULL to parse it as we go
+static const pdesc_t * _pcached(const char * format) {
+    int i;
+    for(i = 0; i < LIBC_PRINTF_CACHE; i++) {
+        if(_pcache[i].fmt == format) {
+            _pcache_hits++;
+            return _pcache[i].d;
         }
-        
-        // mode 7 - modifier
-        if(mode == 7) {
-            // single modifiers - always advance to conversion
-            mode = 8;
-            switch(c) {
-                case 'h':
-                    if(*format == 'h') {
-                        // hh?
-                        mod = 'H';
-                        format++;
-                    } else mod = 'h';
-                    continue;
-                case 'l':
-                    if(*format == 'l') {
-                        // ll?
-                        mod = 'q';
-                        format++;
-                    } else mod = 'l';
-                    continue;
+    }
+    _pcache_misses++;
+#ifdef LIBC_PRINTF_CACHE_AUTO
+    // replace the next unpinned entry
+    for(i = 0; i < LIBC_PRINTF_CACHE; i++) {
+        int j = _pcache_next++ % LIBC_PRINTF_CACHE;
+        if(_pcache[j].pinned) continue;
+        _pcache[j].fmt = _pcompile(format, _pcache[j].d) ? format : NULL;
+        return _pcache[j].fmt ? _pcache[j].d : NULL;
+    }
+#endif
+    return NULL;
+}
+
+#if LIBC_PRINTF_CONVS > 0
+// reparse every cached format (the conversions changed)
+static void _pcache_rebuild(void) {
+    int i;
+    for(i = 0; i < LIBC_PRINTF_CACHE; i++) {
+        if(_pcache[i].fmt && !_pcompile(_pcache[i].fmt, _pcache[i].d)) _pcache[i].fmt = NULL;
+    }
+}
+#endif
+
+/* parse format once and keep it for every later call with the same format pointer (it must stay valid and
+   unchanged) - returns 0 if it does not fit. NULL empties the cache */
+int FNPRE(printf_precompile)(const char * format) {
+    int i, f = -1;
+    for(i = 0; i < LIBC_PRINTF_CACHE; i++) {
+        if(!format) {
+            _pcache[i].fmt = NULL;
+            _pcache[i].pinned = 0;
+            continue;
+        }
+        if(_pcache[i].fmt == format) {
+            _pcache[i].pinned = 1;
+            return 1;
+        }
+        if(!_pcache[i].pinned && (f < 0 || !_pcache[i].fmt)) f = i;
+    }
+    if(!format || f < 0) return 0;
+    if(!_pcompile(format, _pcache[f].d)) {
+        _pcache[f].fmt = NULL;
+        return 0;
+    }
+    _pcache[f].fmt = format;
+    _pcache[f].pinned = 1;
+    return 1;
+}
+
+// calls which found (hits) and did not find (misses) their format in the cache
+void FNPRE(printf_cache_stats)(uint32_t * hits, uint32_t * misses) {
+    if(hits) *hits = _pcache_hits;
+    if(misses) *misses = _pcache_misses;
+}
+#endif
+
+// run one conversion - ret is the output count so far (for %n), returns the characters output
+static int _pconvert(pint_t * pint, char c, char mod, va_list * ap, int ret) {
+    printf_conv_fn fn = _pconv(c);
+    if(fn) {
+        if(pint->flags & FLAG_MINUS) pint->flags &= ~(uint8_t)FLAG_0;
+        return fn(pint, ap);
+    }
+    char tmpc = c;
+    if(c >= 'A' && c <= 'Z') {
+        pint->flags |= FLAG_CAP;
+        tmpc += 'a' - 'A';
+    }
+    if(pint->flags & FLAG_MINUS) pint->flags &= ~(uint8_t)FLAG_0; // ... A  - overrides a 0 if both are given.
+    switch(tmpc) {
+        case 's': // S/mod = 'l'; // skip this as we aren't implementing it anyway...
+            // read both as chars, and trust the ouput function to interpret the charset correctly
+            return _prints(pint, va_arg(*ap, char*));
+
+        case 'c': // C
+            // read both as chars, and trust the ouput function to interpret the charset correctly
+            // parameters will be passed as full ints on all types anyway...
+            _putc(pint, va_arg(*ap, int));
+            return 1;
+            
+        case 'd': tmpc = 'i'; // elliminate duplicat check up top
+        case 'i': 
+        case 'o': 
+        case 'u': 
+        case 'x': {
+            // always read unsigned - if it was signed we will later strip the sign and conver to unsigned
+            switch(mod) {
+                case 'l': if(sizeof(long) == sizeof(int)) break; // only 64 bit on 64 bit hosts
                 case 'q':
-                case 'L':
                 case 'j':
-                //case 'z': // promote to int, so ignore
-                //case 't':
-                    mod = c;
-                    continue;
-                case 'Z':
-                    mod = 'z';
-                    continue;
+                    return _printll(pint, va_arg(*ap, unsigned long long int), tmpc);
+                // all these promote to int
+                //case 'z': i = va_arg(ap, size_t); break;
+                //case 't': i = va_arg(ap, ptrdiff_t); break;
+                //case 'H': // char and short are promoted to int by va_arg
+                //case 'h':
             }
-            // else fall through
+            return _printi(pint, va_arg(*ap, unsigned int), tmpc);
         }
-        
-        // mode 8 - conversion
-        if(mode == 8) {
-            // single conversions - always return to output
-            mode = 0;
-            char tmpc = c;
-            if(c >= 'A' && c <= 'Z') {
-                pint->flags |= FLAG_CAP;
-                tmpc += 'a' - 'A';
-            }
-            if(pint->flags & FLAG_MINUS) pint->flags &= ~(uint8_t)FLAG_0; // ... A  - overrides a 0 if both are given.
-            switch(tmpc) {
-                case 's': // S/mod = 'l'; // skip this as we aren't implementing it anyway...
-                    // read both as chars, and trust the ouput function to interpret the charset correctly
-                    ret += _prints(pint, va_arg(ap, char*));
-                    continue;
-
-                case 'c': // C
-                    // read both as chars, and trust the ouput function to interpret the charset correctly
-                    // parameters will be passed as full ints on all types anyway...
-                    _putc(pint, va_arg(ap, int));
-                    ret++;
-                    continue;
-                    
-                case 'd': tmpc = 'i'; // elliminate duplicat check up top
-                case 'i': 
-                case 'o': 
-                case 'u': 
-                case 'x': {
-                    // always read unsigned - if it was signed we will later strip the sign and conver to unsigned
-                    unsigned int i;
-                    switch(mod) {
-                        case 'q': i = va_arg(ap, unsigned long long int); break;
-                        case 'j': i = va_arg(ap, uintmax_t); break;
-                        // all these promote to int
-                        //case 'z': i = va_arg(ap, size_t); break;
-                        //case 't': i = va_arg(ap, ptrdiff_t); break;
-                        //case 'l': i = va_arg(ap, long int); break;
-                        //case 'H': // char and short are promoted to int by va_arg
-                        //case 'h':
-                        default: i = va_arg(ap, unsigned int);
-                    }
-                    ret += _printi(pint, i, tmpc);
-                    continue;
-                }
 
 #ifdef BUILD_A
-                case 'a': pint->radix=16;
+        case 'a': pint->radix=16;
 #else
-                case 'a': tmpc += 4; // waaaay too expensive to implement a fmt and i doubt it will ever be used
-#endif
-                case 'e':
-                case 'f':
-                case 'g':
-                    ret += _printf(pint, va_arg(ap, double), tmpc);
-                    continue;
-
-                case 'p':
-                    pint->flags = FLAG_0|FLAG_ALT;
-                    pint->width = 8;
-                    pint->prec = 255;
-                    ret += _printi(pint, (uint32_t)va_arg(ap, void*), 'x');
-                    continue;
-
-                case 'm':
-                    pint->flags = 0;
-                    pint->width = 0;
-                    pint->prec = -1;
-                    ret += _printi(pint, errno, 'd');
-                    continue;
-                
-                case 'n': {
-                    void * p = va_arg(ap, void*);
-                    switch(mod) {
-                        case 'H': *(int8_t*)p = ret; break;
-                        case 'h': *(int16_t*)p = ret; break;
-                        case 'L': *(int64_t*)p = ret; break;
-                        default: *(int32_t*)p = ret;
-                    }
-                    continue;
-                }
-                    
+        case 'a': tmpc += 4; // waaaay too expensive to implement a fmt and i doubt it will ever be used
+#endif
+        case 'e':
+        case 'f':
+        case 'g':
+            if(mod == 'h') pint->flags |= FLAG_SINGLE;
+            return _printf(pint, va_arg(*ap, double), tmpc);
+
+        case 'k': {
+            // fraction bits (or -decimal places), then the fixed point value
+            int bits = va_arg(*ap, int);
+            uint64_t num;
+            switch(mod) {
+                case 'l': if(sizeof(long) == sizeof(int)) goto k32;
+                case 'q':
+                case 'j':
+                    num = va_arg(*ap, unsigned long long int);
+                    break;
+                default:
+                k32:
+                    num = va_arg(*ap, unsigned int);
+                    if(!(pint->flags & FLAG_CAP)) num = (int64_t)(int)num;
             }
-            // not consumed - output the char instead
-            _putc(pint, c);
-            ret++;
+            return _printk(pint, num, bits, tmpc);
+        }
+
+        case 'h': { // H - byte count, then the buffer (%hH in lower case)
+            int len = va_arg(*ap, int);
+            if(mod == 'h') pint->flags &= ~(uint8_t)FLAG_CAP;
+            return _printh(pint, va_arg(*ap, const uint8_t *), len);
+        }
+
+        case 'p':
+            pint->flags = FLAG_0|FLAG_ALT;
+            pint->width = 8;
+            pint->prec = 255;
+            return _printi(pint, (uint32_t)va_arg(*ap, void*), 'x');
+
+        case 'm':
+            pint->flags = 0;
+            pint->width = 0;
+            pint->prec = -1;
+            return _printi(pint, errno, 'd');
+        
+        case 'n': {
+            void * p = va_arg(*ap, void*);
+            switch(mod) {
+                case 'H': *(int8_t*)p = ret; break;
+                case 'h': *(int16_t*)p = ret; break;
+                case 'L': *(int64_t*)p = ret; break;
+                default: *(int32_t*)p = ret;
+            }
+            return 0;
+        }
+            
+    }
+    // not consumed - output the char instead
+    _putc(pint, c);
+    return 1;
+}
+
+// load the spec into pint (taking * width/precision from the arguments) and convert
+static int _pexec(pint_t * pint, const pdesc_t * d, va_list * ap, int ret) {
+    pint->radix = 10; // default to 10
+    pint->flags = d->flags;
+    pint->width = d->width;
+    pint->prec = d->prec;
+    if(d->star & PSTAR_WIDTH) {
+        // read width from next parm
+        int i = va_arg(*ap, int);
+        if(i < 0) {
+            pint->flags |= FLAG_MINUS;
+            pint->width = -i;
+        } else {
+            pint->width = i;
+        }
+    }
+    if(d->star & PSTAR_PREC) {
+        // read precision from next parm
+        int i = va_arg(*ap, int);
+        pint->prec = i < 0 ? 255 : i;
+    }
+    return _pconvert(pint, d->conv, d->mod, ap, ret);
+}
+
+// the real deal - this parses the format string and dishes out the individual formats
+int _vprintf(pint_t * pint, const char *format, va_list ap0) {
+    int ret = 0;
+    const char * s;
+    va_list ap; // copy, so conversions can be handed a pointer to it
+    va_copy(ap, ap0);
+    
+#if LIBC_PRINTF_CACHE > 0
+    const pdesc_t * d = _pcached(format);
+    if(d) {
+        // replay the parsed specs
+        for(;; d++) {
+            if(d->lit) ret += _putn(pint, format, d->lit);
+            if(!d->len) break;
+            format += d->lit + d->len;
+            ret += _pexec(pint, d, &ap, ret);
         }
+    } else
+#endif
+    for(;;) {
+        // output the literal run up to the next % in one go
+        s = _pscan(format);
+        if(s != format) ret += _putn(pint, format, s - format);
+        if(!*s) break;
+        pdesc_t spec;
+        if(!(format = _pspec(s + 1, &spec))) break;
+        ret += _pexec(pint, &spec, &ap, ret);
     }
-    if(pint->sptr && (pint->scnt != (size_t)-1)) _putc(pint, 0); // null terminate string output
+    va_end(ap);
+    _pend(pint);
     return ret;
 }
 
 // function wrappers for the libc calls...
 int FNPRE(printf)(const char *format, ...) {
     va_list args;
-    pint_t pint = {0};
+    pstream_t ps;
+    pint_t * pint = _pstream_init(&ps, NULL); // stream output - NULL sptr is the default printer
     va_start(args, format);
-    int ret = _vprintf(&pint, format, args);
+    int ret = _vprintf(pint, format, args);
     va_end(args);
     return ret;
 }
 
 int FNPRE(puts)(const char *s) {
-    pint_t pint = {0};
-    while(*s) _putc(&pint, *(s++));
-    _putc(&pint, '\n');
+    pstream_t ps;
+    pint_t * pint = _pstream_init(&ps, NULL);
+    _putn(pint, s, strlen(s));
+    _putc(pint, '\n');
+    _flush(pint);
     return 1;
 }
 
@@ -860,7 +1802,7 @@ int FNPRE(snprintf)(char *str, size_t size, const char *format, ...) {
     va_list args;
     pint_t pint = {0};
     pint.sptr = str;
-    pint.scnt = size;
+    pint.scnt = str ? size : 0; // NULL only measures
     va_start(args, format);
     int ret = _vprintf(&pint, format, args);
     va_end(args);
@@ -868,8 +1810,8 @@ int FNPRE(snprintf)(char *str, size_t size, const char *format, ...) {
 }
 
 int FNPRE(vprintf)(const char *format, va_list ap) {
-    pint_t pint = {0};
-    return _vprintf(&pint, format, ap);
+    pstream_t ps;
+    return _vprintf(_pstream_init(&ps, NULL), format, ap);
 }
 
 int FNPRE(vsprintf)(char *str, const char *format, va_list ap) {
@@ -882,12 +1824,472 @@ int FNPRE(vsprintf)(char *str, const char *format, va_list ap) {
 int FNPRE(vsnprintf)(char *str, size_t size, const char *format, va_list ap) {
     pint_t pint = {0};
     pint.sptr = str;
-    pint.scnt = size;
+    pint.scnt = str ? size : 0; // NULL only measures
     return _vprintf(&pint, format, ap);
 }
 
+#ifndef LIBC_PRINTF_NOFILE
+/* FILE output - the stream is only a handle for a Print class (stdout/stderr, bound with printf_setfile, or
+   from pfopen), so there is no FILE buffer: output is staged on the stack and written in bulk as for pprintf */
+extern void * _pfile_print(FILE * f); // Print pointer, NULL for the printf sinks, -1 if f is not bound
+
+// stream output to f - NULL if f is not bound
+static pint_t * _pfile(pstream_t * ps, FILE * f) {
+    void * p = _pfile_print(f);
+    if(p == (void *)-1) return NULL;
+    return _pstream_init(ps, p);
+}
+
+int FNPRE(vfprintf)(FILE * f, const char *format, va_list ap) {
+    pstream_t ps;
+    pint_t * pint = _pfile(&ps, f);
+    if(!pint) return -1;
+    return _vprintf(pint, format, ap);
+}
+
+int FNPRE(fprintf)(FILE * f, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int ret = FNPRE(vfprintf)(f, format, args);
+    va_end(args);
+    return ret;
+}
+
+int FNPRE(fputs)(const char *s, FILE * f) {
+    pstream_t ps;
+    pint_t * pint = _pfile(&ps, f);
+    if(!pint) return EOF;
+    _putn(pint, s, strlen(s));
+    _flush(pint);
+    return 1;
+}
+
+int FNPRE(fputc)(int c, FILE * f) {
+    pstream_t ps;
+    pint_t * pint = _pfile(&ps, f);
+    if(!pint) return EOF;
+    _putc(pint, c);
+    _flush(pint);
+    return (unsigned char)c;
+}
+
+size_t FNPRE(fwrite)(const void * buf, size_t size, size_t n, FILE * f) {
+    pstream_t ps;
+    pint_t * pint = _pfile(&ps, f);
+    if(!pint || !size) return 0;
+    if(n > INT_MAX / size) n = INT_MAX / size; // _putn takes an int - a short count, as for a partial write
+    _putn(pint, (const char *)buf, size * n);
+    _flush(pint);
+    return n;
+}
+#endif
+
+/*
+    deferred (binary) logging - instead of formatting, _vplog records the format address and the raw
+    arguments, and the text is rebuilt on the host by the TEST build (_plog_decode, which formats with the
+    same _vprintf). A record is
+        [n - bytes which follow][format address, 4 bytes LE][arguments]
+    ints, * width/precision and %p are 4 bytes, 64 bit ints and doubles 8 (all LE), %s strings are copied
+    with their NUL, %H buffers as a 4 byte count and the bytes. Arguments which do not fit are dropped (and decode as 0).
+    The argument types of registered conversions (printf_register) are unknown, so recording stops at the first one
+*/
+
+// skip one conversion spec (format points after the %) - returns the conversion, sets mod and * count. Parsed
+// by _pspec, so records take exactly the arguments printf would (m$ specs, a registered 'I' ...)
+static const char * _plog_spec(const char * format, char * conv, char * mod, int * stars) {
+    pdesc_t d;
+    const char * e = _pspec(format, &d);
+    *stars = !!(d.star & PSTAR_WIDTH) + !!(d.star & PSTAR_PREC);
+    *mod = d.mod;
+    *conv = d.conv;
+    return e ? e : format + strlen(format);
+}
+
+// bytes of the value argument of a conversion (0 for none, -1 for a string) - lsize is sizeof(long) on the device
+static int _plog_argsize(char conv, char mod, int lsize) {
+    switch(conv | 0x20) {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'c': case 'k':
+            if(mod == 'q' || mod == 'j' || (mod == 'l' && lsize > 4)) return 8;
+            return 4;
+        case 'e': case 'f': case 'g': case 'a':
+            return 8;
+        case 'p':
+            return 4;
+        case 's':
+            return -1;
+        case 'h':
+            return conv == 'H' ? -2 : 0;
+    }
+    return 0;
+}
+
+static int _plog_put(uint8_t * rec, int size, int n, uint64_t v, int bytes) {
+    if(n + bytes > size) return n;
+    while(bytes--) {
+        rec[n++] = (uint8_t)v;
+        v >>= 8;
+    }
+    return n;
+}
+
+// fill rec (size bytes, max 256) with the record for this call - returns the record length
+int _vplog(uint8_t * rec, int size, const char * format, va_list ap) {
+    int n;
+    if(size > 256) size = 256;
+    if(size < 1) return 0; // not even the length byte
+    n = _plog_put(rec, size, 1, (uintptr_t)format, 4);
+    while(*format) {
+        char conv, mod;
+        int stars;
+        if(*format++ != '%') continue;
+        format = _plog_spec(format, &conv, &mod, &stars);
+        if(_pconv(conv)) break; // unknown arguments - the rest decode as 0
+        while(stars--) n = _plog_put(rec, size, n, (uint32_t)va_arg(ap, int), 4);
+        if((conv | 0x20) == 'k') n = _plog_put(rec, size, n, (uint32_t)va_arg(ap, int), 4); // fraction bits
+        switch(_plog_argsize(conv, mod, sizeof(long))) {
+            case 4:
+                if((conv | 0x20) == 'p') n = _plog_put(rec, size, n, (uintptr_t)va_arg(ap, void*), 4);
+                else n = _plog_put(rec, size, n, va_arg(ap, unsigned int), 4);
+                break;
+            case 8:
+                if(strchr("efga", conv | 0x20)) {
+                    double d = va_arg(ap, double);
+                    uint64_t v;
+                    memcpy(&v, &d, 8);
+                    n = _plog_put(rec, size, n, v, 8);
+                } else n = _plog_put(rec, size, n, va_arg(ap, unsigned long long int), 8);
+                break;
+            case -2: {
+                // %H - the count (of bytes which fit), then the bytes
+                int len = va_arg(ap, int);
+                const uint8_t * b = va_arg(ap, const uint8_t *);
+                int i = n + 4;
+                if(!b || len < 0) len = 0;
+                if(i > size) break;
+                if(len > size - i) len = size - i;
+                n = _plog_put(rec, size, n, len, 4);
+                memcpy(rec + n, b, len);
+                n += len;
+                break;
+            }
+            case -1: {
+                const char * str = va_arg(ap, char*);
+                if(!str) str = "(null)";
+                while(n < size - 1 && *str) rec[n++] = *str++;
+                if(n < size) rec[n++] = 0;
+                break;
+            }
+            default:
+                if(conv == 'n') va_arg(ap, void*);
+        }
+    }
+    rec[0] = n - 1;
+    return n;
+}
+
+#ifdef TEST
+static int tst_plog(uint8_t * rec, int size, const char * format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = _vplog(rec, size, format, args);
+    va_end(args);
+    return n;
+}
+#endif
+
 #ifdef TEST
 
+static uint64_t _plog_get(const uint8_t * rec, int n, int * ofs, int bytes) {
+    uint64_t v = 0;
+    int i;
+    for(i = bytes - 1; i >= 0; i--) v = (v << 8) | (*ofs + i < n ? rec[*ofs + i] : 0);
+    *ofs += bytes;
+    return v;
+}
+
+// rebuild the text of one record (rec points at the length byte) given its format string - returns the length
+// assumes a 32 bit device (4 byte long and pointers)
+int _plog_decode(const uint8_t * rec, const char * format, char * out, int size) {
+    int n = rec[0] + 1;
+    int ofs = 5;
+    int len = 0;
+    char spec[32];
+    while(*format) {
+        const char * s = format;
+        char conv, mod;
+        int stars, i;
+        int args[2] = {0, 0};
+        if(*format++ != '%') {
+            if(len < size - 1) out[len] = *s;
+            len++;
+            continue;
+        }
+        format = _plog_spec(format, &conv, &mod, &stars);
+        for(i = 0; i < stars; i++) args[i] = (int32_t)_plog_get(rec, n, &ofs, 4);
+        // rebuild the spec with the * values inlined
+        for(i = 0, stars = 0; s < format && i < (int)sizeof(spec) - 12; s++) {
+            if(*s == '*') {
+                // a negative precision means unset - drop it
+                if(args[stars] < 0 && s[-1] == '.') i--;
+                else i += sprintf(spec + i, "%d", args[stars]);
+                stars++;
+            } else spec[i++] = *s;
+        }
+        spec[i] = 0;
+        char * o = len < size ? out + len : NULL;
+        int room = len < size ? size - len : 0;
+        int bits = (conv | 0x20) == 'k' ? (int32_t)_plog_get(rec, n, &ofs, 4) : 0;
+        switch(_plog_argsize(conv, mod, 4)) { // device long is 32 bits
+            case 4: {
+                uint32_t v = _plog_get(rec, n, &ofs, 4);
+                if((conv | 0x20) == 'p') len += tst_snprintf(o, room, spec, (void*)(uintptr_t)v);
+                else if(mod == 'l') len += tst_snprintf(o, room, spec, (conv | 0x20) == 'd' || (conv | 0x20) == 'i' ? (long)(int32_t)v : (long)v);
+                else if((conv | 0x20) == 'k') len += tst_snprintf(o, room, spec, bits, v);
+                else len += tst_snprintf(o, room, spec, v);
+                break;
+            }
+            case 8: {
+                uint64_t v = _plog_get(rec, n, &ofs, 8);
+                if(strchr("efga", conv | 0x20)) {
+                    double d;
+                    memcpy(&d, &v, 8);
+                    len += tst_snprintf(o, room, spec, d);
+                } else if((conv | 0x20) == 'k') len += tst_snprintf(o, room, spec, bits, v);
+                else len += tst_snprintf(o, room, spec, v);
+                break;
+            }
+            case -2: {
+                int k = _plog_get(rec, n, &ofs, 4);
+                if(k > n - ofs) k = ofs < n ? n - ofs : 0;
+                len += tst_snprintf(o, room, spec, k, rec + ofs);
+                ofs += k;
+                break;
+            }
+            case -1:
+                len += tst_snprintf(o, room, spec, ofs < n ? (const char *)rec + ofs : "");
+                while(ofs < n && rec[ofs++]);
+                break;
+            default:
+                if(conv != 'n') len += tst_snprintf(o, room, spec); // %% etc
+        }
+    }
+    if(size) out[len < size ? len : size - 1] = 0;
+    return len;
+}
+
+// format string at addr in a 32 bit ELF image (any allocated section with contents)
+static const char * _plog_elfstr(const uint8_t * elf, long size, uint32_t addr) {
+    const Elf32_Ehdr * eh = (const Elf32_Ehdr *)elf;
+    int i;
+    if(size < (long)sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) || eh->e_ident[EI_CLASS] != ELFCLASS32) return NULL;
+    for(i = 0; i < eh->e_shnum; i++) {
+        const Elf32_Shdr * sh = (const Elf32_Shdr *)(elf + eh->e_shoff + i * eh->e_shentsize);
+        if(!(sh->sh_flags & SHF_ALLOC) || sh->sh_type == SHT_NOBITS) continue;
+        if(addr >= sh->sh_addr && addr < sh->sh_addr + sh->sh_size && sh->sh_offset + addr - sh->sh_addr < (uint32_t)size) {
+            return (const char *)elf + sh->sh_offset + addr - sh->sh_addr;
+        }
+    }
+    return NULL;
+}
+
+// printf firmware.elf log.bin - decode a deferred log
+static int plog_dump(const char * elfname, const char * logname) {
+    static uint8_t elf[4 << 20], log[1 << 20];
+    char out[1000];
+    FILE * f;
+    long esize, lsize, ofs = 0;
+    if(!(f = fopen(elfname, "rb"))) return 1;
+    esize = fread(elf, 1, sizeof(elf), f);
+    fclose(f);
+    if(!(f = fopen(logname, "rb"))) return 1;
+    lsize = fread(log, 1, sizeof(log), f);
+    fclose(f);
+    while(ofs + 5 <= lsize) {
+        const uint8_t * rec = log + ofs;
+        uint32_t addr = rec[1] | rec[2] << 8 | rec[3] << 16 | (uint32_t)rec[4] << 24;
+        const char * format = _plog_elfstr(elf, esize, addr);
+        if(format) {
+            _plog_decode(rec, format, out, sizeof(out));
+            fputs(out, stdout);
+        } else {
+            printf("<unknown format 0x%08x>\n", addr);
+        }
+        ofs += rec[0] + 1;
+    }
+    return 0;
+}
+
+#if LIBC_PRINTF_CONVS > 0
+// user conversion - %I prints an IPv4 address (host order uint32) as one padded field
+static int _tst_conv_ip(pint_t * pint, va_list * ap) {
+    uint32_t ip = va_arg(*ap, uint32_t);
+    char tmp[16];
+    tst_snprintf(tmp, sizeof(tmp), "%u.%u.%u.%u", ip >> 24, (ip >> 16) & 255, (ip >> 8) & 255, ip & 255);
+    return _prints(pint, tmp);
+}
+#endif
+
+#ifdef BENCH
+#include <time.h>
+#include <fcntl.h>
+
+static double _bench_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// glibc counting sink
+static long _bench_glibc_chars;
+static ssize_t _bench_cookie_write(void * c, const char * buf, size_t n) {
+    _bench_glibc_chars += n;
+    return n;
+}
+
+// size of a symbol in our own image (0 if not found)
+static long _bench_symsize(const char * name) {
+    static uint8_t * elf = NULL;
+    static long size;
+    if(!elf) {
+        FILE * f = fopen("/proc/self/exe", "rb");
+        if(!f) return 0;
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        elf = malloc(size);
+        size = fread(elf, 1, size, f);
+        fclose(f);
+    }
+    const Elf64_Ehdr * eh = (const Elf64_Ehdr *)elf;
+    if(size < (long)sizeof(*eh) || eh->e_ident[EI_CLASS] != ELFCLASS64) return 0;
+    for(int i = 0; i < eh->e_shnum; i++) {
+        const Elf64_Shdr * sh = (const Elf64_Shdr *)(elf + eh->e_shoff + i * eh->e_shentsize);
+        if(sh->sh_type != SHT_SYMTAB) continue;
+        const Elf64_Shdr * st = (const Elf64_Shdr *)(elf + eh->e_shoff + sh->sh_link * eh->e_shentsize);
+        const Elf64_Sym * sym = (const Elf64_Sym *)(elf + sh->sh_offset);
+        for(unsigned j = 0; j < sh->sh_size / sizeof(*sym); j++) {
+            if(!strcmp((const char *)elf + st->sh_offset + sym[j].st_name, name)) return sym[j].st_size;
+        }
+    }
+    return 0;
+}
+
+// time expr - ns per call, repeated until it has run for at least 20ms
+#define BTIME(t, expr) { \
+    long k, reps = 256; \
+    double t0; \
+    for(;;) { \
+        t0 = _bench_now(); \
+        for(k = 0; k < reps; k++) { expr; } \
+        t = (_bench_now() - t0); \
+        if(t > 2e7) break; \
+        reps *= 4; \
+    } \
+    t /= reps; \
+}
+
+// snprintf to a big buffer, to an 8 byte buffer (truncating), and to a counting stream - ours then glibc
+// (the format goes through a volatile, so gcc can not turn glibc calls into memcpy)
+#define BENCH_ROW(name, x, ...) { \
+    double t[6]; \
+    const char * volatile f = x; \
+    int n = tst_snprintf(buf, sizeof(buf), f, ##__VA_ARGS__); \
+    int gn = snprintf(buf, sizeof(buf), f, ##__VA_ARGS__); \
+    BTIME(t[0], tst_snprintf(buf, sizeof(buf), f, ##__VA_ARGS__)) \
+    BTIME(t[1], snprintf(buf, sizeof(buf), f, ##__VA_ARGS__)) \
+    BTIME(t[2], tst_snprintf(buf, 8, f, ##__VA_ARGS__)) \
+    BTIME(t[3], snprintf(buf, 8, f, ##__VA_ARGS__)) \
+    _bench_chars = 0; \
+    BTIME(t[4], tst_printf(f, ##__VA_ARGS__)) \
+    _bench_chars = -1; \
+    BTIME(t[5], fprintf(cnt, f, ##__VA_ARGS__)) \
+    printf("%-12s %4d %7.1f %7.1f %6.0f %6.0f %7.1f %7.1f %7.1f %7.1f\n", name, n, t[0], t[1], n * 1e3 / t[0], gn * 1e3 / t[1], \
+        t[2], t[3], t[4], t[5]); \
+}
+
+static volatile int _bi = -123456789;
+static volatile unsigned _bx = 0xdeadbeef;
+static volatile long long _bll = -1234567890123456789LL;
+static volatile double _bd = 3.14159265358979;
+static volatile double _bbig = 6.02214076e23;
+static volatile double _bsmall = 0.000123456;
+static const char * volatile _bs = "hello world";
+
+int bench(void) {
+    char buf[256];
+    static const cookie_io_functions_t cio = {NULL, _bench_cookie_write, NULL, NULL};
+    FILE * cnt = fopencookie(NULL, "w", cio);
+    setvbuf(cnt, NULL, _IOFBF, 4096);
+    printf("ns per call, and Mchars/s for the full buffer (ours, glibc)\n");
+    printf("%-12s %4s %7s %7s %6s %6s %7s %7s %7s %7s\n", "", "len", "snprnf", "glibc", "Mch/s", "glibc", "trunc8", "glibc", "stream", "glibc");
+    BENCH_ROW("%d", "%d", _bi)
+    BENCH_ROW("%u small", "%u", 7)
+    BENCH_ROW("%x", "%x", _bx)
+    BENCH_ROW("%lld", "%lld", _bll)
+    BENCH_ROW("%s", "%s", _bs)
+    BENCH_ROW("%f", "%f", _bd)
+    BENCH_ROW("%e", "%e", _bbig)
+    BENCH_ROW("%g", "%g", _bsmall)
+    BENCH_ROW("%.17g", "%.17g", _bd)
+    BENCH_ROW("%'g (grp)", "%'g", _bd) // glibc: %g with grouping
+    BENCH_ROW("wide %d", "%-60d|", _bi)
+    BENCH_ROW("wide %s", "%60s|", _bs)
+    BENCH_ROW("literal", "The quick brown fox jumps over the lazy dog, then does it all again for the next 120 characters...\n")
+    BENCH_ROW("log line", "t=%u v=%d.%02d %s %x\n", _bx, _bi, 7, _bs, _bx)
+#if LIBC_PRINTF_CACHE > 0
+    static const char logfmt[] = "t=%u v=%d.%02d %s %x\n";
+    tst_printf_precompile(logfmt);
+    BENCH_ROW("log precomp", logfmt, _bx, _bi, 7, _bs, _bx)
+    tst_printf_precompile(NULL);
+#endif
+    fclose(cnt);
+
+    // file output - the host sink (writev) against a glibc FILE with the same buffering, all to /dev/null
+    int fd = open("/dev/null", O_WRONLY);
+    FILE * nline = fdopen(dup(fd), "w");
+    FILE * nfull = fdopen(dup(fd), "w");
+    setvbuf(nline, NULL, _IOLBF, HOST_SINK_BUF);
+    setvbuf(nfull, NULL, _IOFBF, HOST_SINK_BUF);
+    printf("\nfile output, ns per call and MB/s (host sink, glibc FILE), and writev calls per 1000 calls\n");
+    printf("%-16s %4s %7s %7s %6s %6s %7s\n", "", "len", "sink", "glibc", "MB/s", "glibc", "writev");
+#define BFILE(name, mode, file, x, ...) { \
+    double t[2]; \
+    long calls = 0; \
+    const char * volatile f = x; \
+    int n = tst_snprintf(buf, sizeof(buf), f, ##__VA_ARGS__); \
+    printf_hostsink(fd, mode); \
+    _hsink.writes = 0; \
+    BTIME(t[0], (tst_printf(f, ##__VA_ARGS__), calls++)) \
+    printf_hostsink(-1, 0); \
+    long w = _hsink.writes; \
+    BTIME(t[1], fprintf(file, f, ##__VA_ARGS__)) \
+    fflush(file); \
+    printf("%-16s %4d %7.1f %7.1f %6.0f %6.0f %7.1f\n", name, n, t[0], t[1], n * 1e3 / t[0], n * 1e3 / t[1], w * 1e3 / calls); \
+}
+    BFILE("log line, line", HOST_SINK_LINE, nline, "t=%u v=%d.%02d %s %x\n", _bx, _bi, 7, _bs, _bx)
+    BFILE("literal, line", HOST_SINK_LINE, nline, "The quick brown fox jumps over the lazy dog, then does it all again for the next 120 characters...\n")
+    BFILE("log line, full", HOST_SINK_FULL, nfull, "t=%u v=%d.%02d %s %x\n", _bx, _bi, 7, _bs, _bx)
+    BFILE("literal, full", HOST_SINK_FULL, nfull, "The quick brown fox jumps over the lazy dog, then does it all again for the next 120 characters...\n")
+    BFILE("wide %s, full", HOST_SINK_FULL, nfull, "%200s|", _bs)
+    fclose(nline);
+    fclose(nfull);
+    close(fd);
+    
+    // code sizes in this (host) build - the target figures will differ, but the proportions hold
+    static const char * const syms[] = {"_vprintf", "_putn", "_prints", "_printi", "_printll", "_printf", "_printk",
+        "_printh", "_pow10", "_hexpair", "_vplog", "_phexdump", NULL};
+    long total = 0;
+    printf("\ncode bytes (host)");
+    for(int i = 0; syms[i]; i++) {
+        long s = _bench_symsize(syms[i]);
+        total += s;
+        printf("%s %s %ld", i % 6 ? "," : "\n ", syms[i], s);
+    }
+    printf("\n total %ld\n", total);
+    return 0;
+}
+#endif
+
 void stress(void) {
     char b1[100];
     char b2[100];
@@ -912,7 +2314,7 @@ void stress(void) {
     }
 }
 
-int main(void) {
+int main(int argc, char ** argv) {
     char buf[1000];
     char buf1[1000];
     int i;
@@ -921,6 +2323,11 @@ int main(void) {
     int32_t ni;
     int64_t nl;
     
+    if(argc == 3) return plog_dump(argv[1], argv[2]);
+#ifdef BENCH
+    return bench();
+#endif
+    
     // set glibc to round towards 0
     fesetround(FE_TOWARDZERO );
     
@@ -983,13 +2390,171 @@ int main(void) {
     TPRINT("foo %% '%.20f' '%.20f' '%.20f' '%.20f'", 1234567890e20f, 432109876543e-20f, 123456789012345.0f, 234567890123456789e5f)
     TPRINT("foo %% '%f' '%f' '%f'", NAN, INFINITY, -INFINITY)
     TPRINT("foo %% '%.0f' '%.0f' '%.0f'", 0.5f, -0.5f, 0.0f)
+    TPRINT("foo %% '%.17g' '%.15e' '%f' '%g' '%e'", 0.1, 1.0 / 3, 1e15, 1e300, 5e-324)
     TPRINT("foo %% '%20.0a' '%20.4a' '%20.4a' '%20.4a' 1 %hhn 2  %hn 3  %n 4  %lln 5", 99.0, 9999999999999.0, 0.099, 12345e-10f, &nc, &ns, &ni, &nl)
     fprintf(stderr, "%d %d %d %lld\n", nc, ns, ni, nl);
+    TPRINT("foo %% '%lld' '%llu' '%-25lld' '%+lld' '%020llu'", -9223372036854775807LL - 1, 18446744073709551615ULL, 1000000000000000000LL, 999999999LL, 4294967296ULL)
+    TPRINT("foo %% '%llx' '%#llX' '%llo' '%#30llo' '%jd' '%.25lld'", 0x123456789abcdefULL, 0xfedcba9876543210ULL, 01777777777777777777777ULL, 0x8000000000000000ULL, (intmax_t)-1000000000, 1234567890123LL)
     TPRINT("foo '%s' '%10s' '%010s' '%-10s' bar", "abcdefg", "abcdefg", "abcdefg", "abcdefg")
     TPRINT("foo '%s' '%10s' '%010s' '%-10s' bar", "abcdefgabcdefg", "abcdefgabcdefg", "abcdefgabcdefg", "abcdefgabcdefg")
     TPRINT("foo '%s' '%10.5s' '%010.5s' '%-10.5s' bar", "abcdefgabcdefg", "abcdefgabcdefg", "abcdefgabcdefg", "abcdefgabcdefg")
 #endif
     tst_printf("%f\n", 1e32f);
+    // measure only, and truncation - must count the same as a full format
+#define TMEASURE(x, ...) \
+    i = tst_snprintf(NULL, 0, x, ##__VA_ARGS__); \
+    printf("measure %d %d %d\n", i, tst_snprintf(buf1, 4, x, ##__VA_ARGS__), snprintf(NULL, 0, x, ##__VA_ARGS__)); \
+    if(i != snprintf(NULL, 0, x, ##__VA_ARGS__) || strlen(buf1) != 3) printf("############################### FAIL ###############################\n");
+    TMEASURE("foo '%s' '%10s' '%-5.2s' '%c' %%", "bar", "abc", "abc", 'x')
+    TMEASURE("'%d' '%+08i' '%#x' '%-6o' '%.5u' '%lld'", -12345, 99, 0xbeef, 8, 7, -1234567890123LL)
+    TMEASURE("'%f' '%12.3e' '%-10g' '%+.0f' '%f'", 3.25, -1e100, 0.5, 99.9, NAN)
+    // formats glibc does not have - checked against the expected text
+#define TEXPECT(e, x, ...) { \
+    i = tst_snprintf_nf(buf, sizeof(buf), x, ##__VA_ARGS__); \
+    printf("%s\n", buf); \
+    if(i != (int)strlen(e) || strcmp(buf, e) != 0) printf("############################### FAIL ###############################\n"); \
+}
+    TEXPECT("fixed '1.500000' '-12.345' '1.99    ' '+00000.5' '1.50000000349245965480' '1.999999'",
+        "fixed '%k' '%.3k' '%-8.2k' '%+08.1k' '%.20lk' '%K'", 16, 0x18000, -3, -12345, 8, 0x1ff, 15, 0x4000, 32, 0x18000000fLL, 31, 0xffffffffU)
+    TEXPECT("fixed '1.500' '-1.500' '4294967295.000000' '-0.5' '0.5'",
+        "fixed '%.3k' '%.3k' '%K' '%.1k' '%.1K'", 1, 3, 1, -3, 0, 0xffffffffU, 31, 0xc0000000U, 31, 0x40000000U)
+    TEXPECT("fixed scales '0.000000000000000000000000000005' '0.0000' '0.999999' '-0.250000' '-0.000000'",
+        "fixed scales '%k' '%.4k' '%lk' '%lk' '%lk'", -30, 5, -25, 123456, 62, 0x3fffffffffffffffLL, 64, 0xc000000000000000ULL, 200, -1LL)
+    tst_printf_nf("shortest '%'g' '%'g' '%'g' '%'e' '%'f' '%'hg' '%'g'\n", 0.1, 1.0 / 3, 1e21, 1234567.0, 0.25, 0.1f, 5e-324);
+    // deferred log records must decode to the same text
+#define TPLOG(x, ...) { \
+    uint8_t rec[256]; \
+    int n = tst_plog(rec, sizeof(rec), x, ##__VA_ARGS__); \
+    _plog_decode(rec, x, buf, sizeof(buf)); \
+    tst_snprintf_nf(buf1, sizeof(buf1), x, ##__VA_ARGS__); \
+    printf("plog (%d): '%s'\n", n, buf); \
+    if(strcmp(buf, buf1) != 0 || n != rec[0] + 1) printf("############################### FAIL ###############################\n"); \
+}
+    TPLOG("log %d %u %x %c %%", -5, 4000000000U, 0xbeef, 'z')
+    TPLOG("log '%*.*d' '%-*s' '%.*f'", 8, 4, 42, 6, "ab", -1, 2.5)
+    TPLOG("log %lld %e %'g %.3k %s", -1234567890123LL, 1e-300, 0.1, 16, 0x18000, "end")
+    TPLOG("log [% H] %d", 5, "\x01\xab\xff\x10\x7f", 7)
+    TPLOG("log %5$d %.2$d %d %Zd", 7, 8)
+    if(tst_plog((uint8_t *)buf, 0, "log %d", 1) != 0) printf("############################### FAIL ###############################\n");
+    // hex buffers and dumps
+    TEXPECT("hex 'DEADBEEF' '00 7F 80' '0X12AB          ' '      616263' ''",
+        "hex '%H' '% H' '%#-16H' '%12H' '%H'", 4, "\xde\xad\xbe\xef", 3, "\x00\x7f\x80", 2, "\x12\xab", 3, "abc", 0, NULL)
+    TEXPECT("mac 24 0A C4 01 02 03 24 0a c4 01 02 03 0x240ac4", "mac % H % hH %#hH", 6, "\x24\x0a\xc4\x01\x02\x03",
+        6, "\x24\x0a\xc4\x01\x02\x03", 3, "\x24\x0a\xc4")
+    {
+        static const char dump[] =
+            "0000: 1e 25 2c 33 3a 41 48 4f 56 5d 64 6b 72 79 80 87  |.%,3:AHOV]dkry..|\n"
+            "0010: 8e 95 9c a3 aa b1 b8 bf c6 cd d4 db e2 e9 f0 f7  |................|\n"
+            "0020: fe 05 0c 13 1a 21 28 2f                          |.....!(/|\n"
+            "1E 25 2C 33 3A\n";
+        pint_t pint = {0};
+        uint8_t b[40];
+        for(i = 0; i < (int)sizeof(b); i++) b[i] = i * 7 + 30;
+        pint.sptr = buf;
+        pint.scnt = sizeof(buf);
+        i = _phexdump(&pint, b, sizeof(b), HEXDUMP_OFFSET | HEXDUMP_ASCII);
+        i += _phexdump(&pint, b, 5, HEXDUMP_UPPER);
+        _pend(&pint);
+        printf("%shexdump %d\n", buf, i);
+        if(i != (int)strlen(dump) || strcmp(buf, dump) != 0) printf("############################### FAIL ###############################\n");
+    }
+#if LIBC_PRINTF_CONVS > 0
+    tst_printf_register('I', _tst_conv_ip);
+    tst_printf_nf("conv '%I' '%-18I' '%*I' %d\n", 0xc0a80001, 0x0a000102, 16, 0x7f000001, 42);
+#endif
+#if LIBC_PRINTF_CACHE > 0
+    // precompiled formats must give the same output as parsing them
+#define TCACHE(x, ...) { \
+    static const char f[] = x; \
+    int n0 = tst_snprintf_nf(buf, sizeof(buf), f, ##__VA_ARGS__); \
+    int ok = tst_printf_precompile(f); \
+    int n1 = tst_snprintf_nf(buf1, sizeof(buf1), f, ##__VA_ARGS__); \
+    printf("cache %d (%d): '%s'\n", ok, n1, buf1); \
+    if(n0 != n1 || strcmp(buf, buf1) != 0) printf("############################### FAIL ###############################\n"); \
+}
+    TCACHE("plain")
+    TCACHE("%d|%-8.3s|%*.*x|%%|%I|%hhd %lld", 42, "abcdef", -7, 3, 0xbeef, 0xc0a80001, 300, 1LL << 40)
+    TCACHE("%5$d %.-3d %.*f %'g %'.3e %", 1, 2, -1, 1.5, 0.1, 123456.0)
+    TCACHE("%#010X %c %+.2k % H", 42, 'c', 8, 0x1ff, 3, "\x01\x02\x03")
+    tst_printf_precompile(NULL); // room again
+    TCACHE("%d%d%d%d%d%d%d%d!", 1, 2, 3, 4, 5, 6, 7, 8) // LIBC_PRINTF_CACHE_SPECS - kept
+    TCACHE("%d%d%d%d%d%d%d%d%d", 1, 2, 3, 4, 5, 6, 7, 8, 9) // too many specs - not kept
+    {
+        uint32_t hits, misses;
+        tst_printf_cache_stats(&hits, &misses);
+        tst_printf_precompile(NULL);
+        printf("cache hits %u misses %u\n", hits, misses);
+    }
+#endif
+    // host sink - line and full buffered output to a file must read back as written
+    {
+        static char big[HOST_SINK_BUF + 100], back[2 * sizeof(big) + 200];
+        FILE * f = tmpfile();
+        int fd = fileno(f), k, mode;
+        memset(big, 'b', sizeof(big) - 1);
+        for(mode = HOST_SINK_LINE; mode <= HOST_SINK_FULL; mode++) {
+            printf_hostsink(fd, mode);
+            _hsink.writes = 0;
+            tst_printf("line %d\npart", mode);
+            k = _hsink.used; // "part" waits in either mode
+            tst_printf(" %s|%s\n", "end", big);
+            printf_hostflush();
+            printf_hostsink(-1, 0);
+            printf("hostsink %d: held %d, %ld writes\n", mode, k, _hsink.writes);
+        }
+        lseek(fd, 0, SEEK_SET);
+        k = read(fd, back, sizeof(back) - 1);
+        back[k < 0 ? 0 : k] = 0;
+        tst_snprintf(buf, sizeof(buf), "line 1\npart end|");
+        i = strlen(buf);
+        if(k != 2 * (i + (int)sizeof(big)) || strncmp(back, buf, i) || back[k - 1] != '\n' || strncmp(back + k / 2, "line 2", 6))
+            printf("############################### FAIL ###############################\n");
+        fclose(f);
+    }
+#ifndef LIBC_PRINTF_NOFILE
+    // FILE shims - stdout and stderr go to the printf sinks (the test output), other streams are not bound
+    tst_fputs("fputs ", stdout);
+    tst_fprintf(stdout, "fprintf %d ", 5);
+    tst_fwrite("fwrite|xx", 1, 7, stdout);
+    tst_fputc('\n', stderr);
+    {
+        // stderr bound to a Print - the text and the return values must match
+        static const char exp[] = "fprintf 5|fputs|fwrite!";
+        int r[4];
+        _tst_pfile = stderr;
+        _tst_pcnt = 0;
+        r[0] = tst_fprintf(stderr, "fprintf %d|", 5);
+        r[1] = tst_fputs("fputs|", stderr);
+        r[2] = tst_fwrite("fwrite|xx", 1, 6, stderr);
+        r[3] = tst_fputc('!', stderr);
+        _tst_pfile = NULL;
+        printf("bound '%.*s' %d %d %d %d\n", _tst_pcnt, _tst_pout, r[0], r[1], r[2], r[3]);
+        if(_tst_pcnt != (int)strlen(exp) || memcmp(_tst_pout, exp, _tst_pcnt) || r[0] != 10 || r[1] < 0 || r[2] != 6 || r[3] != '!')
+            printf("############################### FAIL ###############################\n");
+        // a libc FILE is not bound - nothing is written
+        r[0] = tst_fprintf(stdin, "x");
+        r[1] = tst_fputs("x", stdin);
+        r[2] = tst_fwrite("x", 1, 1, stdin);
+        r[3] = tst_fputc('x', stdin);
+        printf("unbound %d %d %d %d\n", r[0], r[1], r[2], r[3]);
+        if(r[0] != -1 || r[1] != EOF || r[2] != 0 || r[3] != EOF || _tst_pcnt != (int)strlen(exp))
+            printf("############################### FAIL ###############################\n");
+    }
+#endif
+    // literal scan against strcspn at every alignment and length
+    {
+        char t[80];
+        int e = 0, j;
+        for(i = 0; i < 16; i++) {
+            for(j = 0; j < 40; j++) {
+                memset(t, 'a' + (j & 7), sizeof(t));
+                t[i + j] = (j & 1) ? '%' : 0;
+                t[sizeof(t) - 1] = 0;
+                if(_pscan(t + i) != t + i + strcspn(t + i, "%")) e++;
+            }
+        }
+        printf("pscan %s\n", e ? "############################### FAIL ###############################" : "OK");
+    }
     stress();
     return 0;
 }
@@ -21,18 +21,87 @@
 
 #include <Arduino.h>
 #include <stdarg.h>
+#include <limits.h>
 #include "local_printf.h"
+#include "LibC.h"
+#include "local_atomic.h"
 
-Print * _printf_printer = NULL;
+/* printf sinks - the output is formatted once, and each staged chunk is written to every sink whose mask
+   overlaps the mask of the call */
+static struct {
+    Print * p;
+    uint8_t mask;
+} _printf_sinks[LIBC_PRINTF_SINKS];
+static uint8_t _printf_mask = 0xff;
 
+static void _sinks_write(uint8_t mask, const uint8_t * buf, int n) {
+    for(int i = 0; i < LIBC_PRINTF_SINKS; i++) {
+        if(_printf_sinks[i].p && (_printf_sinks[i].mask & mask)) _printf_sinks[i].p->write(buf, n);
+    }
+}
+
+// replace all sinks with p
 void printf_setprint(Print * p) {
-    _printf_printer = p;
+    memset(_printf_sinks, 0, sizeof(_printf_sinks));
+    _printf_sinks[0].p = p;
+    _printf_sinks[0].mask = 0xff;
+}
+
+// add p (or change its mask) - returns 0 if there is no free slot
+int printf_addsink(Print * p, uint8_t mask) {
+    int i, f = -1;
+    for(i = 0; i < LIBC_PRINTF_SINKS; i++) {
+        if(_printf_sinks[i].p == p) break;
+        if(f < 0 && !_printf_sinks[i].p) f = i;
+    }
+    if(i == LIBC_PRINTF_SINKS) {
+        if(f < 0) return 0;
+        i = f;
+    }
+    _printf_sinks[i].mask = mask;
+    _printf_sinks[i].p = p;
+    return 1;
+}
+
+void printf_removesink(Print * p) {
+    for(int i = 0; i < LIBC_PRINTF_SINKS; i++) {
+        if(_printf_sinks[i].p == p) _printf_sinks[i].p = NULL;
+    }
+}
+
+// select the sinks printf/vprintf/puts write to - returns the previous mask
+uint8_t printf_setmask(uint8_t mask) {
+    uint8_t old = _printf_mask;
+    _printf_mask = mask;
+    return old;
 }
 
 extern "C" void _printf_putchar(int c) {
-    _printf_printer->print((char)c);
+    uint8_t b = c;
+    _sinks_write(_printf_mask, &b, 1);
+}
+
+extern "C" void _printf_write(const char * buf, int n) {
+    _sinks_write(_printf_mask, (const uint8_t *)buf, n);
 }
 
+// one mprintf call - fans out to the sinks in mask
+class _SinkFan : public Print {
+public:
+    _SinkFan(uint8_t m) : mask(m) {}
+    using Print::write;
+    virtual size_t write(uint8_t c) {
+        _sinks_write(mask, &c, 1);
+        return 1;
+    }
+    virtual size_t write(const uint8_t * buf, size_t n) {
+        _sinks_write(mask, buf, n);
+        return n;
+    }
+private:
+    uint8_t mask;
+};
+
 extern "C" int _vprintf(pint_t * pint, const char *format, va_list ap);
 
 extern "C" void _pprintf_putchar(void * p, int c) {
@@ -41,13 +110,391 @@ extern "C" void _pprintf_putchar(void * p, int c) {
     pr->print((char)c);
 }
 
+extern "C" void _pprintf_write(void * p, const char * buf, int n) {
+    if(!p) return;
+    Print * pr = (Print*)p;
+    pr->write((const uint8_t *)buf, n);
+}
+
 int pprintf(Print& p, const char *format, ...) {
     va_list args;
-    pint_t pint = {0};
-    pint.sptr = (char*)&p;
-    pint.scnt = (size_t)-1;
+    pstream_t ps;
+    pint_t * pint = _pstream_init(&ps, &p);
+    va_start(args, format);
+    int ret = _vprintf(pint, format, args);
+    va_end(args);
+    return ret;
+}
+
+// as printf, but to the sinks in mask rather than those selected by printf_setmask
+int mprintf(uint8_t mask, const char *format, ...) {
+    va_list args;
+    _SinkFan f(mask);
+    pstream_t ps;
+    pint_t * pint = _pstream_init(&ps, (Print*)&f);
+    va_start(args, format);
+    int ret = _vprintf(pint, format, args);
+    va_end(args);
+    return ret;
+}
+
+LibC::StrBuf::StrBuf(size_t reserve) {
+    sbuf = NULL;
+    slen = scap = 0;
+    oom = false;
+    if(reserve && grow(reserve)) sbuf[0] = 0;
+}
+
+LibC::StrBuf::~StrBuf() {
+    free(sbuf);
+}
+
+// room for n more bytes and the terminator - the quarter length extra bounds the copying when the block
+// cannot grow in place
+bool LibC::StrBuf::grow(size_t n) {
+    if(oom) return false;
+    if(slen + n < scap) return true;
+    size_t cap = slen + n + 1 + LIBC_STRBUF_STEP + (slen >> 2);
+    char * p = (char *)realloc(sbuf, cap);
+    if(!p) {
+        oom = true;
+        return false;
+    }
+    sbuf = p;
+    scap = cap;
+    return true;
+}
+
+size_t LibC::StrBuf::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t LibC::StrBuf::write(const uint8_t * buf, size_t n) {
+    if(!grow(n)) return 0;
+    memcpy(sbuf + slen, buf, n);
+    slen += n;
+    sbuf[slen] = 0;
+    return n;
+}
+
+int LibC::StrBuf::vappendf(const char * format, va_list ap) {
+    pstream_t ps;
+    pint_t * pint = _pstream_init(&ps, (Print*)this);
+    int ret = _vprintf(pint, format, ap);
+    return oom ? -1 : ret;
+}
+
+int LibC::StrBuf::appendf(const char * format, ...) {
+    va_list args;
+    va_start(args, format);
+    int ret = vappendf(format, args);
+    va_end(args);
+    return ret;
+}
+
+void LibC::StrBuf::clear(void) {
+    free(sbuf);
+    sbuf = NULL;
+    slen = scap = 0;
+    oom = false;
+}
+
+const char * LibC::StrBuf::compact(void) {
+    if(sbuf && scap > slen + 1) {
+        char * p = (char *)realloc(sbuf, slen + 1); // shrinking splits the spare off in place
+        if(p) {
+            sbuf = p;
+            scap = slen + 1;
+        }
+    }
+    if(sbuf) sbuf = (char *)crealloc(sbuf);
+    return c_str();
+}
+
+char * LibC::StrBuf::release(void) {
+    char * ret = NULL;
+    if(sbuf && !oom) {
+        compact();
+        ret = sbuf;
+        sbuf = NULL;
+    }
+    clear();
+    return ret;
+}
+
+// formatted in one pass into a StrBuf - *strp must be freed, and is NULL (with -1 returned) if out of memory
+extern "C" int vasprintf(char ** strp, const char * format, va_list ap) {
+    LibC::StrBuf b(LIBC_STRBUF_STEP);
+    int ret = b.vappendf(format, ap);
+    *strp = b.release();
+    return *strp ? ret : -1;
+}
+
+extern "C" int asprintf(char ** strp, const char * format, ...) {
+    va_list args;
+    va_start(args, format);
+    int ret = vasprintf(strp, format, args);
+    va_end(args);
+    return ret;
+}
+
+/* FILE streams - stdout and stderr (slots 0 and 1) write to the printf sinks until bound to a Print, pfopen
+   streams are handles for one of the other slots (never pass them to libc) */
+static Print * _pfiles[2 + LIBC_PRINTF_FILES];
+
+// slot of f, -1 if it is not one of ours
+static int _pfile_slot(FILE * f) {
+    // stdout/stderr are compared on every call, as libc may only set them up on first use
+    if(f == stdout) return 0;
+    if(f == stderr) return 1;
+    for(int i = 2; i < 2 + LIBC_PRINTF_FILES; i++) {
+        if((void *)f == (void *)&_pfiles[i]) return i;
+    }
+    return -1;
+}
+
+extern "C" void * _pfile_print(FILE * f) {
+    int i = _pfile_slot(f);
+    if(i < 0 || (i > 1 && !_pfiles[i])) return (void *)-1; // unknown, or a closed pfopen stream
+    return _pfiles[i];
+}
+
+// bind stdout/stderr (or a pfopen stream) to p - NULL returns stdout/stderr to the printf sinks
+void printf_setfile(FILE * f, Print * p) {
+    int i = _pfile_slot(f);
+    if(i >= 0) _pfiles[i] = p;
+}
+
+// a FILE handle for p, for fprintf/fputs/fputc/fwrite - NULL if all LIBC_PRINTF_FILES are open
+FILE * pfopen(Print& p) {
+    for(int i = 2; i < 2 + LIBC_PRINTF_FILES; i++) {
+        if(!_pfiles[i]) {
+            _pfiles[i] = &p;
+            return (FILE *)&_pfiles[i];
+        }
+    }
+    return NULL;
+}
+
+void pfclose(FILE * f) {
+    int i = _pfile_slot(f);
+    if(i > 1) _pfiles[i] = NULL;
+}
+
+extern "C" void _pend(pint_t * pint);
+extern "C" int _phexdump(pint_t * pint, const uint8_t * buf, int len, int flags);
+
+// hex dump of len bytes at buf, 16 per line (flags HEXDUMP_*) - one write per line
+int phexdump(Print& p, const void * buf, size_t len, uint8_t flags) {
+    pstream_t ps;
+    pint_t * pint = _pstream_init(&ps, &p);
+    int ret = _phexdump(pint, (const uint8_t *)buf, len, flags);
+    _pend(pint);
+    return ret;
+}
+
+extern "C" int _vplog(uint8_t * rec, int size, const char * format, va_list ap);
+
+// deferred log - send the format address and raw arguments, the host formats them (see printf.c)
+int plog(Print& p, const char *format, ...) {
+    va_list args;
+    uint8_t rec[LIBC_PLOG_RECORD];
     va_start(args, format);
-    int ret = _vprintf(&pint, format, args);
+    int n = _vplog(rec, sizeof(rec), format, args);
     va_end(args);
+    return p.write(rec, n);
+}
+
+/*
+    PrintQueue - lock free ring buffer of records, each a 4 byte header followed by the data, padded to 4
+    bytes. Any number of writers (main or interrupt context) reserve space by advancing head with a compare
+    and swap, copy their data and then mark the header ready. The single reader (printf_service from loop)
+    sends ready records in order, then zeroes them before advancing tail - free space is always zero, so a
+    header which has been reserved but not written yet never looks ready. A record which does not fit before
+    the end of the buffer is preceded by a skip record padding to the end.
+*/
+#define Q_READY 0x80
+#define Q_SKIP 0x40
+#define Q_BUSY_DRAIN 0x01
+#define Q_BUSY_FREE 0x02
+#define Q_COPY 32 // bytes copied out per write when writers may overwrite the record being sent
+#define Q_MIN 8 // smallest ring - a header and one word of data
+
+typedef struct {
+    uint16_t len;
+    uint8_t state;
+    uint8_t pad;
+} qhdr_t;
+
+#define Q_REC(n) (sizeof(qhdr_t) + (((n) + 3) & ~3U))
+
+static LibC::PrintQueue * _printf_queues = NULL;
+
+LibC::PrintQueue::PrintQueue(Print& o, void * buf, uint16_t size, uint8_t pol) : out(o) {
+    qsize = 0x8000;
+    while(qsize > size) qsize >>= 1;
+    if(qsize < Q_MIN) qsize = 0; // no room for a record - everything is dropped
+    qbuf = (uint8_t *)buf;
+    memset(qbuf, 0, qsize);
+    policy = pol;
+    busy = 0;
+    head = tail = 0;
+    rofs = 0;
+    dropped = overwritten = 0;
+    next = _printf_queues;
+    _printf_queues = this;
+}
+
+LibC::PrintQueue::~PrintQueue() {
+    for(LibC::PrintQueue ** p = &_printf_queues; *p; p = &(*p)->next) {
+        if(*p == this) {
+            *p = next;
+            break;
+        }
+    }
+}
+
+uint16_t LibC::PrintQueue::queued(void) {
+    return (uint16_t)(head - tail);
+}
+
+// in an interrupt handler? Only known on Cortex-M (IPSR) - elsewhere BLOCK always drains inline
+static inline bool _q_isr(void) {
+#if defined(__ARM_ARCH_PROFILE) && __ARM_ARCH_PROFILE == 'M'
+    uint32_t ipsr;
+    __asm__ volatile("mrs %0, ipsr" : "=r"(ipsr));
+    return ipsr != 0;
+#else
+    return false;
+#endif
+}
+
+/* discard the oldest record to make space (OVERWRITE policy). Writers in the main context and in interrupts can
+   both get here for the same record, so it is claimed by clearing its state with a compare and swap - the loser
+   sees it is no longer ready. Tail only moves once the record is zeroed, as writers may reuse the space at once */
+bool LibC::PrintQueue::pop(void) {
+    if(busy & Q_BUSY_FREE) return false; // consumer is releasing it
+    uint16_t t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+    if(t == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) return false;
+    qhdr_t * h = (qhdr_t *)(qbuf + (t & (qsize - 1)));
+    uint8_t st = __atomic_load_n(&h->state, __ATOMIC_ACQUIRE);
+    if(!(st & Q_READY)) return false; // still being written, or claimed
+    if(!LIBC_ATOMIC_CAS(&h->state, &st, (uint8_t)0)) return false;
+    if(__atomic_load_n(&tail, __ATOMIC_ACQUIRE) != t) {
+        // released and the space reused since we looked - this is a newer record, put it back
+        __atomic_store_n(&h->state, st, __ATOMIC_RELEASE);
+        return false;
+    }
+    uint16_t len = h->len;
+    if(!(st & Q_SKIP)) LIBC_ATOMIC_ADD(&overwritten, len);
+    memset(h, 0, Q_REC(len));
+    LIBC_ATOMIC_CAS(&tail, &t, (uint16_t)(t + Q_REC(len))); // ours alone while claimed
+    return true;
+}
+
+bool LibC::PrintQueue::push(const uint8_t * s, uint16_t n) {
+    uint16_t need = Q_REC(n);
+    for(;;) {
+        uint16_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+        uint16_t t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+        uint16_t ofs = h & (qsize - 1);
+        uint16_t skip = ofs + need > qsize ? qsize - ofs : 0;
+        if((uint16_t)(h - t) + skip + need > qsize) {
+            // full
+            if(policy == PRINTF_QUEUE_BLOCK && !busy && !_q_isr() && service(0) > 0) continue;
+            if(policy == PRINTF_QUEUE_OVERWRITE && pop()) continue;
+            LIBC_ATOMIC_ADD(&dropped, n);
+            return false;
+        }
+        if(!LIBC_ATOMIC_CAS(&head, &h, (uint16_t)(h + skip + need))) continue;
+        qhdr_t * r;
+        if(skip) {
+            r = (qhdr_t *)(qbuf + ofs);
+            r->len = skip - sizeof(qhdr_t);
+            __atomic_store_n(&r->state, Q_READY | Q_SKIP, __ATOMIC_RELEASE);
+            ofs = 0;
+        }
+        r = (qhdr_t *)(qbuf + ofs);
+        memcpy(r + 1, s, n);
+        r->len = n;
+        __atomic_store_n(&r->state, Q_READY, __ATOMIC_RELEASE);
+        return true;
+    }
+}
+
+size_t LibC::PrintQueue::write(uint8_t c) {
+    return push(&c, 1);
+}
+
+size_t LibC::PrintQueue::write(const uint8_t * buf, size_t n) {
+    size_t ret = 0;
+    uint16_t max = qsize / 4; // split big writes, so a record always fits
+    if(!max) {
+        LIBC_ATOMIC_ADD(&dropped, n);
+        return 0;
+    }
+    while(n) {
+        uint16_t k = n > max ? max : n;
+        if(push(buf, k)) ret += k;
+        buf += k;
+        n -= k;
+    }
+    return ret;
+}
+
+int LibC::PrintQueue::service(int max) {
+    int ret = 0;
+    if(busy) return 0; // re-entered from out, or from an interrupt
+    busy = Q_BUSY_DRAIN;
+    if(max < 0) max = out.availableForWrite();
+    else if(max == 0) max = INT_MAX;
+    for(;;) {
+        uint16_t t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+        if(t == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) break;
+        qhdr_t * h = (qhdr_t *)(qbuf + (t & (qsize - 1)));
+        uint8_t st = __atomic_load_n(&h->state, __ATOMIC_ACQUIRE);
+        if(!(st & Q_READY)) break; // oldest record is still being written
+        uint16_t len = h->len;
+        if(!(st & Q_SKIP)) {
+            const uint8_t * d = (const uint8_t *)(h + 1);
+            while(rofs < len && max > 0) {
+                int k = len - rofs;
+                if(k > max) k = max;
+                if(policy == PRINTF_QUEUE_OVERWRITE) {
+                    // copy out, and only send it if nobody discarded the record meanwhile
+                    uint8_t tmp[Q_COPY];
+                    if(k > Q_COPY) k = Q_COPY;
+                    memcpy(tmp, d + rofs, k);
+                    if(__atomic_load_n(&tail, __ATOMIC_ACQUIRE) != t) break;
+                    out.write(tmp, k);
+                } else {
+                    out.write(d + rofs, k);
+                }
+                rofs += k;
+                ret += k;
+                max -= k;
+            }
+            if(__atomic_load_n(&tail, __ATOMIC_ACQUIRE) != t) {
+                rofs = 0; // overwritten under us - start on the new oldest
+                continue;
+            }
+            if(rofs < len) break; // port is full
+        }
+        __atomic_store_n(&busy, Q_BUSY_DRAIN | Q_BUSY_FREE, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&tail, __ATOMIC_ACQUIRE) == t) {
+            memset(h, 0, Q_REC(len));
+            __atomic_store_n(&tail, (uint16_t)(t + Q_REC(len)), __ATOMIC_RELEASE);
+        }
+        __atomic_store_n(&busy, Q_BUSY_DRAIN, __ATOMIC_SEQ_CST);
+        rofs = 0;
+    }
+    busy = 0;
+    return ret;
+}
+
+// drain every PrintQueue as far as its port will take without blocking - call from loop()
+int printf_service(void) {
+    int ret = 0;
+    for(LibC::PrintQueue * q = _printf_queues; q; q = q->next) ret += q->service();
     return ret;
 }
@@ -0,0 +1,566 @@
+/*
+ * Copyright 2018 Justin Schoeman
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+ * software and associated documentation files (the "Software"), to deal in the Software 
+ * without restriction, including without limitation the rights to use, copy, modify, 
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+ * permit persons to whom the Software is furnished to do so, subject to the following 
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+    Compile as follows to test (strtof uses printf.c's powers of ten)...
+    gcc -DTEST -Dmain=printf_main -Os -c -o printf_t.o printf.c
+    gcc -DTEST -Os -g -Wall -o scanf scanf.c printf_t.o -lm
+*/
+
+/*
+    NOTES
+    
+    1. One scanner (one character look ahead) is shared by sscanf/vsscanf, pscanf (Stream input) and
+    strtol/strtoul/strtof, so the parsers are only linked once.
+    
+    2. Integers are accumulated in 64 bits (ll/j are full 64 bit), clamped to the 64 bit
+    range on overflow, then truncated to the target type.
+    
+    3. Floats are parsed integer first - up to 19 significant digits and a decimal exponent - then scaled
+    with printf.c's cached powers of ten and rounded straight to the 32 bit float bits, without any float
+    arithmetic.  %lf/%Lf store a double, but only with float precision.  No hex floats.
+    
+    4. No m (allocate) modifier, and no m$ positional arguments.
+    
+    5. strtof('0x') style partial prefixes back up only for string input - a Stream can not push back.
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <ctype.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include "local_printf.h"
+
+#ifdef TEST
+#define FNPRE(x) tst_ ## x
+#define TESTFN(x) x
+// need prototypes for test variants
+int FNPRE(sscanf)(const char *str, const char *format, ...);
+int FNPRE(vsscanf)(const char *str, const char *format, va_list ap);
+long FNPRE(strtol)(const char *nptr, char **endptr, int base);
+unsigned long FNPRE(strtoul)(const char *nptr, char **endptr, int base);
+float FNPRE(strtof)(const char *nptr, char **endptr);
+// dummy for c test env
+int _pscanf_getc(void * p, int consume) {
+    return -1;
+}
+#else
+#define FNPRE(x) x
+#define TESTFN(x)
+#endif
+
+extern int _pscanf_getc(void * p, int consume);
+
+typedef struct {
+    const char * s; // string input, or NULL to read from stream
+    void * stream; // Stream pointer for pscanf
+    int n; // characters consumed (%n)
+    uint8_t eof; // the stream timed out - don't wait again
+} scan_t;
+
+#define SCAN_DIGITS 0x01 // at least one digit was consumed
+#define SCAN_NEG 0x02
+#define SCAN_OVER 0x04 // overflowed 64 bits
+
+// next character, without consuming it (-1 at the end)
+static int _peek(scan_t * sc) {
+    int c;
+    if(sc->s) return *sc->s ? (uint8_t)*sc->s : -1;
+    if(sc->eof) return -1;
+    c = _pscanf_getc(sc->stream, 0);
+    if(c < 0) sc->eof = 1;
+    return c;
+}
+
+static void _next(scan_t * sc) {
+    sc->n++;
+    if(sc->s) sc->s++;
+    else _pscanf_getc(sc->stream, 1);
+}
+
+// consume c (either case) if it is next
+static int _accept(scan_t * sc, char c) {
+    if((_peek(sc) | 0x20) != c) return 0;
+    _next(sc);
+    return 1;
+}
+
+static void _skipws(scan_t * sc) {
+    int c;
+    while((c = _peek(sc)) >= 0 && isspace(c)) _next(sc);
+}
+
+static int _digit(int c, int base) {
+    if(c >= '0' && c <= '9') c -= '0';
+    else if((c | 0x20) >= 'a' && (c | 0x20) <= 'z') c = (c | 0x20) - 'a' + 10;
+    else return -1;
+    return c < base ? c : -1;
+}
+
+// integer of up to width characters - base 0 detects 0x/0 prefixes - returns SCAN_* flags
+static int _scanint(scan_t * sc, int base, int width, uint64_t * val) {
+    int ret = 0;
+    int d;
+    uint64_t v = 0;
+    if(width <= 0) width = INT_MAX;
+    if(_peek(sc) == '-' || _peek(sc) == '+') {
+        if(_peek(sc) == '-') ret |= SCAN_NEG;
+        _next(sc);
+        width--;
+    }
+    if((base == 0 || base == 16) && width > 0 && _peek(sc) == '0') {
+        _next(sc);
+        width--;
+        ret |= SCAN_DIGITS;
+        if(width > 0 && _accept(sc, 'x')) {
+            width--;
+            base = 16;
+            if(_digit(_peek(sc), 16) < 0 && sc->s) {
+                // just "0" - give the x back
+                sc->s--;
+                sc->n--;
+            }
+        } else if(base == 0) {
+            base = 8;
+        }
+    }
+    if(base == 0) base = 10;
+    for(; width > 0 && (d = _digit(_peek(sc), base)) >= 0; width--) {
+        _next(sc);
+        ret |= SCAN_DIGITS;
+        if(v > (UINT64_MAX - d) / base) ret |= SCAN_OVER;
+        v = v * base + d;
+    }
+    *val = v;
+    return ret;
+}
+
+// float of up to width characters into the float bits - returns SCAN_* flags
+static int _scanfloat(scan_t * sc, int width, uint32_t * bits) {
+    int ret = 0;
+    uint64_t m = 0;
+    int e10 = 0;
+    int dot = 0;
+    int c;
+    *bits = 0;
+    if(width <= 0) width = INT_MAX;
+    if(_peek(sc) == '-' || _peek(sc) == '+') {
+        if(_peek(sc) == '-') ret |= SCAN_NEG;
+        _next(sc);
+        width--;
+    }
+    if(width >= 3 && (_peek(sc) | 0x20) == 'i') {
+        if(_accept(sc, 'i') && _accept(sc, 'n') && _accept(sc, 'f')) {
+            *bits = 0x7f800000;
+            ret |= SCAN_DIGITS;
+            if(width >= 8 && _accept(sc, 'i') && _accept(sc, 'n') && _accept(sc, 'i') && _accept(sc, 't')) _accept(sc, 'y');
+        }
+        goto sign;
+    }
+    if(width >= 3 && (_peek(sc) | 0x20) == 'n') {
+        if(_accept(sc, 'n') && _accept(sc, 'a') && _accept(sc, 'n')) {
+            *bits = 0x7fc00000;
+            ret |= SCAN_DIGITS;
+        }
+        goto sign;
+    }
+    for(; width > 0; width--) {
+        c = _peek(sc);
+        if(c == '.' && !dot) {
+            dot = 1;
+        } else if(c >= '0' && c <= '9') {
+            ret |= SCAN_DIGITS;
+            if(m < 1000000000000000000ULL) {
+                m = m * 10 + c - '0'; // 19 significant digits
+                e10 -= dot;
+            } else {
+                e10 += !dot;
+            }
+        } else {
+            break;
+        }
+        _next(sc);
+    }
+    if(!(ret & SCAN_DIGITS)) return ret;
+    if(width > 1 && (_peek(sc) | 0x20) == 'e') {
+        const char * s = sc->s;
+        uint64_t e;
+        _next(sc);
+        int f = _scanint(sc, 10, width - 1, &e);
+        if(!(f & SCAN_DIGITS)) {
+            if(s) {
+                // just "e" - give it back
+                sc->n -= sc->s - s;
+                sc->s = s;
+            }
+        } else {
+            if(e > 1000 || (f & SCAN_OVER)) e = 1000;
+            e10 += f & SCAN_NEG ? -(int)e : (int)e;
+        }
+    }
+    if(m == 0) {
+        // zero
+    } else if(e10 < -70) {
+        errno = ERANGE; // too small even for a denormal
+    } else if(e10 > 40) {
+        *bits = 0x7f800000;
+        errno = ERANGE;
+    } else {
+        uint64_t f;
+        int e = _dscale(&f, m, e10) + 63; // value is 1.x * 2^e
+        int shift = 40; // 24 significant bits
+        uint32_t b = 0;
+        if(e < -126) shift += -126 - e; // denormal
+        if(shift < 64) {
+            uint64_t half = (uint64_t)1 << (shift - 1);
+            uint64_t rest = f & ((half << 1) - 1);
+            b = f >> shift;
+            if(rest > half || (rest == half && (b & 1))) b++; // round to nearest even
+        } else if(shift == 64) {
+            b = f > (uint64_t)1 << 63;
+        }
+        if(e < -126) {
+            *bits = b; // denormal - rounding up to 1 << 23 makes the smallest normal
+            if(b < 1U << 23) errno = ERANGE;
+        } else {
+            if(b >> 24) {
+                b >>= 1;
+                e++;
+            }
+            if(e > 127) {
+                *bits = 0x7f800000;
+                errno = ERANGE;
+            } else {
+                *bits = (uint32_t)(e + 127) << 23 | (b & 0x7fffff);
+            }
+        }
+    }
+sign:
+    if(ret & SCAN_NEG) *bits |= 0x80000000U;
+    return ret;
+}
+
+static float _bits2f(uint32_t bits) {
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// scanf core - returns the number of assigned conversions, or EOF if the input ended before the first one
+int _vscanf(scan_t * sc, const char *format, va_list ap) {
+    int ret = 0;
+    char c;
+    while((c = *format++)) {
+        if(isspace((uint8_t)c)) {
+            _skipws(sc);
+            continue;
+        }
+        if(c != '%' || *format == '%') {
+            if(c == '%') {
+                format++;
+                _skipws(sc);
+            }
+            if(_peek(sc) != (uint8_t)c) break;
+            _next(sc);
+            continue;
+        }
+        int skip = 0;
+        int width = 0;
+        char mod = 0;
+        if(*format == '*') {
+            skip = 1;
+            format++;
+        }
+        while(isdigit((uint8_t)*format)) width = width * 10 + *format++ - '0';
+        switch(*format) {
+            case 'h':
+            case 'l':
+                mod = *format++;
+                if(*format == mod) {
+                    mod = mod == 'l' ? 'q' : 'H';
+                    format++;
+                }
+                break;
+            case 'q':
+            case 'L':
+            case 'j':
+            case 'z':
+            case 't':
+                mod = *format++;
+        }
+        c = *format++;
+        if(!c) break;
+        if(c == 'n') {
+            if(!skip) *va_arg(ap, int *) = sc->n;
+            continue;
+        }
+        if(c != 'c' && c != '[') _skipws(sc);
+        if(_peek(sc) < 0) return ret ? ret : EOF;
+        switch(c) {
+            case 'c': {
+                char * p = skip ? NULL : va_arg(ap, char *);
+                if(!width) width = 1;
+                while(width-- > 0 && _peek(sc) >= 0) {
+                    if(p) *p++ = _peek(sc);
+                    _next(sc);
+                }
+                if(width >= 0) return ret; // ran out
+                break;
+            }
+            case 's':
+            case '[': {
+                // scanset - 256 bits of accepted characters
+                uint8_t set[32];
+                int inv = 0;
+                int k;
+                char * p = skip ? NULL : va_arg(ap, char *);
+                if(c == 's') {
+                    memset(set, 0xff, sizeof(set));
+                    for(k = 0; k < 256; k++) if(isspace(k)) set[k >> 3] &= ~(1 << (k & 7));
+                } else {
+                    memset(set, 0, sizeof(set));
+                    if(*format == '^') {
+                        inv = 1;
+                        format++;
+                    }
+                    if(*format == ']') {
+                        set[']' >> 3] |= 1 << (']' & 7);
+                        format++;
+                    }
+                    for(; *format && *format != ']'; format++) {
+                        int lo = (uint8_t)*format, hi = lo;
+                        if(format[1] == '-' && format[2] && format[2] != ']') {
+                            hi = (uint8_t)format[2];
+                            format += 2;
+                        }
+                        for(k = lo; k <= hi; k++) set[k >> 3] |= 1 << (k & 7);
+                    }
+                    if(*format) format++;
+                    if(inv) for(k = 0; k < 32; k++) set[k] = ~set[k];
+                    set[0] &= ~1; // never NUL
+                }
+                if(!width) width = INT_MAX;
+                for(k = 0; k < width && (c = _peek(sc)) >= 0 && (set[(uint8_t)c >> 3] & (1 << (c & 7))); k++) {
+                    if(p) *p++ = c;
+                    _next(sc);
+                }
+                if(!k) return ret;
+                if(p) *p = 0;
+                break;
+            }
+            case 'e': case 'f': case 'g': case 'a':
+            case 'E': case 'F': case 'G': case 'A': {
+                uint32_t bits;
+                if(!(_scanfloat(sc, width, &bits) & SCAN_DIGITS)) return ret;
+                if(skip) continue;
+                if(mod == 'l' || mod == 'L') *va_arg(ap, double *) = _bits2f(bits);
+                else *va_arg(ap, float *) = _bits2f(bits);
+                break;
+            }
+            case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'p': {
+                uint64_t v;
+                int base = c == 'i' ? 0 : c == 'o' ? 8 : c == 'd' || c == 'u' ? 10 : 16;
+                int f = _scanint(sc, base, width, &v);
+                if(!(f & SCAN_DIGITS)) return ret;
+                if(c == 'd' || c == 'i') {
+                    if((f & SCAN_OVER) || v > (uint64_t)INT64_MAX + (f & SCAN_NEG ? 1 : 0)) v = f & SCAN_NEG ? (uint64_t)INT64_MIN : INT64_MAX;
+                    else if(f & SCAN_NEG) v = -v;
+                } else if(f & SCAN_OVER) v = UINT64_MAX;
+                else if(f & SCAN_NEG) v = -v;
+                if(skip) continue;
+                if(c == 'p') {
+                    *va_arg(ap, void **) = (void *)(uintptr_t)v;
+                    break;
+                }
+                switch(mod) {
+                    case 'H': *va_arg(ap, char *) = v; break;
+                    case 'h': *va_arg(ap, short *) = v; break;
+                    case 'l': *va_arg(ap, long *) = v; break;
+                    case 'q': case 'L': case 'j': *va_arg(ap, long long *) = v; break;
+                    case 'z': *va_arg(ap, size_t *) = v; break;
+                    case 't': *va_arg(ap, ptrdiff_t *) = v; break;
+                    default: *va_arg(ap, int *) = v;
+                }
+                break;
+            }
+            default:
+                return ret; // unknown conversion
+        }
+        if(!skip) ret++;
+    }
+    return ret;
+}
+
+int FNPRE(vsscanf)(const char *str, const char *format, va_list ap) {
+    scan_t sc = {0};
+    sc.s = str;
+    return _vscanf(&sc, format, ap);
+}
+
+int FNPRE(sscanf)(const char *str, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int ret = FNPRE(vsscanf)(str, format, args);
+    va_end(args);
+    return ret;
+}
+
+// Stream input - see scanf.cpp
+int _vpscanf(void * stream, const char *format, va_list ap) {
+    scan_t sc = {0};
+    sc.stream = stream;
+    return _vscanf(&sc, format, ap);
+}
+
+unsigned long FNPRE(strtoul)(const char *nptr, char **endptr, int base) {
+    scan_t sc = {0};
+    uint64_t v;
+    sc.s = nptr;
+    _skipws(&sc);
+    int f = _scanint(&sc, base, 0, &v);
+    if(endptr) *endptr = (char *)(f & SCAN_DIGITS ? sc.s : nptr);
+    if((f & SCAN_OVER) || v > ULONG_MAX) {
+        errno = ERANGE;
+        return ULONG_MAX;
+    }
+    return f & SCAN_NEG ? -(unsigned long)v : (unsigned long)v;
+}
+
+long FNPRE(strtol)(const char *nptr, char **endptr, int base) {
+    scan_t sc = {0};
+    uint64_t v;
+    sc.s = nptr;
+    _skipws(&sc);
+    int f = _scanint(&sc, base, 0, &v);
+    if(endptr) *endptr = (char *)(f & SCAN_DIGITS ? sc.s : nptr);
+    if((f & SCAN_OVER) || v > (uint64_t)LONG_MAX + (f & SCAN_NEG ? 1 : 0)) {
+        errno = ERANGE;
+        return f & SCAN_NEG ? LONG_MIN : LONG_MAX;
+    }
+    return f & SCAN_NEG ? (long)-v : (long)v;
+}
+
+float FNPRE(strtof)(const char *nptr, char **endptr) {
+    scan_t sc = {0};
+    uint32_t bits;
+    sc.s = nptr;
+    _skipws(&sc);
+    int f = _scanfloat(&sc, 0, &bits);
+    if(endptr) *endptr = (char *)(f & SCAN_DIGITS ? sc.s : nptr);
+    return _bits2f(bits);
+}
+
+#ifdef TEST
+
+// glibc and ours scan into v in turn - the results must match
+static struct {
+    int a;
+    long b;
+    float f;
+    char s[32];
+    unsigned u;
+    int n;
+} v, w;
+
+#define TSCAN(in, fmt, ...) { \
+    memset(&v, 0, sizeof(v)); \
+    int r1 = sscanf(in, fmt, ##__VA_ARGS__); \
+    w = v; \
+    memset(&v, 0, sizeof(v)); \
+    int r2 = tst_sscanf(in, fmt, ##__VA_ARGS__); \
+    printf("'%s' '%s': %d %d | %d %ld %g '%s' %u %d\n", in, fmt, r1, r2, v.a, v.b, v.f, v.s, v.u, v.n); \
+    if(r1 != r2 || memcmp(&v, &w, sizeof(v))) printf("############################### FAIL ###############################\n"); \
+}
+
+int main(void) {
+    long i;
+    char * e1;
+    char * e2;
+    static const char * const ints[] = {"0", "-1", "+42", "0x1f", "0X", "0xg", "077", "08", "  123abc", "2147483647", "2147483648", "-2147483648", "-2147483649", "4294967295", "99999999999999999999999", "", "-", "z", NULL};
+    static const int bases[] = {0, 8, 10, 16, 36};
+    for(i = 0; ints[i]; i++) {
+        for(int b = 0; b < 5; b++) {
+            errno = 0;
+            long l1 = strtol(ints[i], &e1, bases[b]);
+            int er1 = errno;
+            errno = 0;
+            long l2 = tst_strtol(ints[i], &e2, bases[b]);
+            int er2 = errno;
+            errno = 0;
+            unsigned long u1 = strtoul(ints[i], NULL, bases[b]);
+            unsigned long u2 = tst_strtoul(ints[i], NULL, bases[b]);
+            if(l1 != l2 || e1 != e2 || er1 != er2 || u1 != u2) printf("strtol '%s' %d: %ld %ld %d %d %lu %lu ########## FAIL ##########\n", ints[i], bases[b], l1, l2, (int)(e1 - ints[i]), (int)(e2 - ints[i]), u1, u2);
+        }
+    }
+    static const char * const flts[] = {"0", "1", "-2.5", "0.1", "3.14159265358979", "1e10", "1.5e-3x", "1e", "1e+", ".5", "5.", ".", "1e38", "3.4028235e38", "3.4028236e38", "1e39", "1e-38", "1.17549435e-38", "1.4e-45", "7e-46", "1e-50", "inf", "-Infinity", "nan", "123456789012345678901234567890", "0.000000000000000000000000000000123456789", "16777217", "33554431", "2.2250738585072014e-308", NULL};
+    for(i = 0; flts[i]; i++) {
+        errno = 0;
+        float f1 = strtof(flts[i], &e1);
+        int er1 = errno;
+        errno = 0;
+        float f2 = tst_strtof(flts[i], &e2);
+        int er2 = errno;
+        printf("strtof '%s' %.9g %.9g\n", flts[i], f1, f2);
+        if(memcmp(&f1, &f2, 4) && !(isnan(f1) && isnan(f2))) printf("############################### FAIL ###############################\n");
+        if(e1 != e2 || er1 != er2) printf("end %d %d errno %d %d ########## FAIL ##########\n", (int)(e1 - flts[i]), (int)(e2 - flts[i]), er1, er2);
+    }
+    // random round trips
+    for(i = 0; i < 1000000; i++) {
+        char b[32];
+        uint32_t r = (uint32_t)rand() << 16 ^ rand();
+        float f;
+        memcpy(&f, &r, 4);
+        if(isnan(f) || isinf(f)) continue;
+        snprintf(b, sizeof(b), i & 1 ? "%.9g" : "%.7g", f);
+        float f1 = strtof(b, NULL);
+        float f2 = tst_strtof(b, NULL);
+        if(memcmp(&f1, &f2, 4)) {
+            printf("strtof '%s' %.9g %.9g ########## FAIL ##########\n", b, f1, f2);
+            break;
+        }
+    }
+    printf("strtof random %ld\n", i);
+    TSCAN("12 34", "%d %d", &v.a, &v.n)
+    TSCAN("12 34", "%d", &v.a) 
+    TSCAN("  -7 x", "%d %ld", &v.a, &v.b)
+    TSCAN("cmd=set val=0x1F", "cmd=%31s", v.s)
+    TSCAN("cmd=set val=0x1F", "cmd=%[a-z] val=%i", v.s, &v.a)
+    TSCAN("temp 21.5C", "temp %fC", &v.f)
+    TSCAN("abc,def", "%[^,],%s", v.s, v.s + 8)
+    TSCAN("12345", "%2d%3u", &v.a, &v.u)
+    TSCAN("100%", "%d%%", &v.a)
+    TSCAN("", "%d", &v.a)
+    TSCAN("x", "%d", &v.a)
+    TSCAN("1 2", "%*d %d%n", &v.a, &v.n)
+    TSCAN("  hello", "%c", v.s)
+    TSCAN("-0.5e1 ff", "%g %x", &v.f, &v.u)
+    TSCAN("99999999999999999999 -99999999999999999999", "%d %ld", &v.a, &v.b)
+    TSCAN("9223372036854775808 -9223372036854775809", "%ld %d", &v.b, &v.a)
+    TSCAN("99999999999999999999 -1", "%u %i", &v.u, &v.a)
+    return 0;
+}
+#endif
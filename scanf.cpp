@@ -0,0 +1,50 @@
+/*
+ * Copyright 2018 Justin Schoeman
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+ * software and associated documentation files (the "Software"), to deal in the Software 
+ * without restriction, including without limitation the rights to use, copy, modify, 
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+ * permit persons to whom the Software is furnished to do so, subject to the following 
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+/* how long pscanf waits for the next character (ms) before it gives up */
+#ifndef LIBC_SCANF_TIMEOUT
+#define LIBC_SCANF_TIMEOUT 1000
+#endif
+
+extern "C" int _vpscanf(void * stream, const char *format, va_list ap);
+
+// next character from the Stream (waiting up to LIBC_SCANF_TIMEOUT), consume it if consume is set
+extern "C" int _pscanf_getc(void * p, int consume) {
+    Stream * s = (Stream*)p;
+    int c = s->peek();
+    if(c < 0) {
+        unsigned long start = millis();
+        while((c = s->peek()) < 0 && millis() - start < LIBC_SCANF_TIMEOUT) yield();
+    }
+    if(c >= 0 && consume) s->read();
+    return c;
+}
+
+int pscanf(Stream& s, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int ret = _vpscanf(&s, format, args);
+    va_end(args);
+    return ret;
+}